@@ -50,4 +50,6 @@ endif()
 find_package(MFEM)
 set_target_properties(mfem PROPERTIES INTERFACE_INCLUDE_DIRECTORIES "${MFEM_INCLUDE_DIRS}")
 
-find_package(Boost)
\ No newline at end of file
+find_package(Boost)
+
+find_package(Threads REQUIRED)
\ No newline at end of file
@@ -1,5 +1,6 @@
 include(CMakeFindDependencyMacro)
 find_dependency(Boost)
 find_dependency(MFEM)
+find_dependency(Threads)
 set_target_properties(mfem PROPERTIES INTERFACE_INCLUDE_DIRECTORIES "${MFEM_INCLUDE_DIRS}")
 include(${CMAKE_CURRENT_LIST_DIR}/raytracerTargets.cmake)
\ No newline at end of file
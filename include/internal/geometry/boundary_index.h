@@ -0,0 +1,69 @@
+#ifndef RAYTRACER_BOUNDARY_INDEX_H
+#define RAYTRACER_BOUNDARY_INDEX_H
+
+#include <vector>
+#include <utility.h>
+#include "geometry_primitives.h"
+
+namespace raytracer {
+
+    /**
+     * Bounding volume hierarchy over the boundary faces of a mesh.
+     * Finds the point where a ray enters the mesh visiting only the faces whose bounding boxes
+     * the ray passes through, instead of testing every boundary face. The result is the same
+     * as findClosestIntersectionPoint(ray, boundaryFaces) gives, including ties going to the face
+     * that is later in the boundaryFaces sequence.
+     * The index stores the face coordinates, so it has to be rebuilt if the mesh nodes move.
+     */
+    class BoundaryIndex {
+    public:
+        BoundaryIndex() = default;
+
+        /**
+         * Build the hierarchy.
+         * @param boundaryFaces faces with two points each
+         */
+        explicit BoundaryIndex(std::vector<Face *> boundaryFaces);
+
+        /**
+         * Find the closest point where the ray hits one of the boundary faces.
+         * @param ray
+         * @param result PointOnFace that is filled in if a hit is found
+         * @return true if a hit was found
+         */
+        bool findEntryPoint(const Ray &ray, PointOnFace &result) const;
+
+        /**
+         * Find entry points of all the rays, e.g. generated by a Laser.
+         * @param rays
+         * @param threadsCount number of threads, 0 means all hardware threads
+         * @return entry point of every ray, empty if the ray misses the mesh
+         */
+        std::vector<tl::optional<PointOnFace>> findEntryPoints(
+                const std::vector<Ray> &rays,
+                unsigned threadsCount = 1
+        ) const;
+
+        /** @return the indexed faces in their original order */
+        const std::vector<Face *> &getFaces() const;
+
+    private:
+        struct Node {
+            double minX, minY, maxX, maxY;
+            /** Leaf: index of the first face in order, inner node: index of the second child */
+            std::size_t index;
+            /** Number of faces of a leaf, zero for inner nodes whose first child follows right after */
+            std::size_t count;
+        };
+
+        std::vector<Face *> faces;
+        std::vector<std::size_t> order;
+        std::vector<Node> nodes;
+
+        std::size_t build(std::size_t begin, std::size_t end, const std::vector<Point> &centroids);
+
+        bool isHit(const Node &node, const Ray &ray, double &entryParam) const;
+    };
+}
+
+#endif //RAYTRACER_BOUNDARY_INDEX_H
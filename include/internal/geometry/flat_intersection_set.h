@@ -0,0 +1,206 @@
+#ifndef RAYTRACER_FLAT_INTERSECTION_SET_H
+#define RAYTRACER_FLAT_INTERSECTION_SET_H
+
+#include <cstdint>
+#include "intersection.h"
+
+namespace raytracer {
+
+    /**
+     * Compact storage of intersections of all rays.
+     * Intersections of all rays are stored one after another in struct of arrays layout using 32-bit ids
+     * instead of pointers. Intersections of ray i span the flat indices [getRayBegin(i), getRayEnd(i)).
+     * An intersection takes 44 bytes instead of the 72 of Intersection and passes over all the intersections
+     * go linearly through memory. The Intersection view is reconstructed on demand using the mesh.
+     * Only the crossing id of the first intersection of a ray is stored, the ids of the following ones are
+     * taken as consecutive, which holds for rays traced by traceRays, see getCrossingId.
+     */
+    class FlatIntersectionSet {
+    public:
+        /**
+         * Construct an empty set of intersections with given mesh.
+         * @param mesh used to reconstruct faces and elements from their ids
+         */
+        explicit FlatIntersectionSet(const Mesh &mesh);
+
+        /**
+         * Construct the set as a copy of an IntersectionSet.
+         * @param mesh the intersectionSet was found at
+         * @param intersectionSet
+         */
+        FlatIntersectionSet(const Mesh &mesh, const IntersectionSet &intersectionSet);
+
+        /**
+         * Add intersection to the end of the last unfinished ray.
+         * @param intersection
+         */
+        void append(const Intersection &intersection);
+
+        /**
+         * Finish the current ray, following append() calls will start a new one.
+         */
+        void endRay();
+
+        /**
+         * Add all rays of another set after the rays of this one.
+         * @param other
+         */
+        void append(const FlatIntersectionSet &other);
+
+        /**
+         * Add all rays of the parts after the rays of this one, in the order of the parts.
+         * The arrays of this set are sized once and every array of the parts is released right after
+         * it is copied, so the peak memory is that of the parts and this set plus a single array.
+         * @param parts sets of the same mesh, left empty
+         * @param threadsCount number of threads copying the parts, 0 means all hardware threads
+         */
+        void append(std::vector<FlatIntersectionSet> &&parts, unsigned threadsCount = 1);
+
+        /** @return number of finished rays */
+        std::size_t getRaysCount() const;
+
+        /** @return number of intersections of all rays */
+        std::size_t getIntersectionsCount() const;
+
+        /** @return flat index of the first intersection of the ray */
+        std::size_t getRayBegin(std::size_t rayIndex) const;
+
+        /** @return flat index past the last intersection of the ray */
+        std::size_t getRayEnd(std::size_t rayIndex) const;
+
+        /**
+         * Reconstruct the intersection at given flat index.
+         * The ray of the intersection is found by binary search, passes over rays should use
+         * getIntersection(rayIndex, index) instead.
+         * @param index flat index
+         * @return the intersection
+         */
+        Intersection getIntersection(std::size_t index) const;
+
+        /**
+         * Reconstruct the intersection at given flat index of given ray.
+         * @param rayIndex index of the ray the intersection belongs to
+         * @param index flat index
+         * @return the intersection
+         */
+        Intersection getIntersection(std::size_t rayIndex, std::size_t index) const;
+
+        /**
+         * Reconstruct all the intersections.
+         * @return IntersectionSet
+         */
+        IntersectionSet toIntersectionSet() const;
+
+        /** @return the mesh the intersections belong to */
+        const Mesh &getMesh() const;
+
+        /** @return x coordinate of the intersection point at flat index */
+        double getX(std::size_t index) const { return x[index]; }
+
+        /** @return y coordinate of the intersection point at flat index */
+        double getY(std::size_t index) const { return y[index]; }
+
+        /** @return direction of the ray after the intersection at flat index */
+        Vector getDirection(std::size_t index) const { return {directionX[index], directionY[index]}; }
+
+        /** @return id of the intersected face at flat index */
+        int getFaceId(std::size_t index) const { return faceIds[index]; }
+
+        /** @return id of the element the ray goes to or -1 */
+        int getNextElementId(std::size_t index) const { return nextElementIds[index]; }
+
+        /** @return id of the element the ray came from or -1 */
+        int getPreviousElementId(std::size_t index) const { return previousElementIds[index]; }
+
+    private:
+        template<typename T>
+        void appendColumn(
+                std::vector<T> FlatIntersectionSet::*column,
+                std::vector<FlatIntersectionSet> &parts,
+                const std::vector<std::size_t> &partBegins,
+                unsigned threadsCount
+        );
+
+        const Mesh *mesh;
+        std::vector<std::size_t> offsets;
+        std::vector<std::int64_t> rayFirstIds;
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> directionX;
+        std::vector<double> directionY;
+        std::vector<std::int32_t> faceIds;
+        std::vector<std::int32_t> nextElementIds;
+        std::vector<std::int32_t> previousElementIds;
+    };
+
+    /**
+     * Same as findIntersections, but the intersections are stored in a FlatIntersectionSet.
+     * Rays are traced in blocks, each block into its own set, which are appended in order,
+     * so the result does not depend on threadsCount.
+     * @return all intersections
+     */
+    template<typename IntersectionFunction, typename StopCondition>
+    FlatIntersectionSet findFlatIntersections(const Mesh &mesh,
+                                              const std::vector<Ray> &initialDirections,
+                                              const std::vector<DirectionFunction> &findDirection,
+                                              IntersectionFunction &&findIntersection,
+                                              StopCondition &&stopCondition,
+                                              InterErrLog *errLog = nullptr,
+                                              unsigned threadsCount = 1
+    );
+
+    //End of header, template garbage follows---------------------------------------------------------------------------
+
+    namespace impl {
+        struct FlatIntersectionsCollector {
+            FlatIntersectionSet &intersectionSet;
+
+            bool onIntersection(std::size_t, const Intersection *, const Intersection &current) {
+                intersectionSet.append(current);
+                return true;
+            }
+
+            void onRayEnd(std::size_t) {
+                intersectionSet.endRay();
+            }
+        };
+    }
+
+    template<typename IntersectionFunction, typename StopCondition>
+    FlatIntersectionSet findFlatIntersections(
+            const Mesh &mesh,
+            const std::vector<Ray> &initialDirections,
+            const std::vector<DirectionFunction> &findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            InterErrLog *errLog,
+            unsigned threadsCount
+    ) {
+        const std::size_t blockSize = 256;
+        const std::size_t blocksCount = (initialDirections.size() + blockSize - 1) / blockSize;
+        std::vector<FlatIntersectionSet> blocks(blocksCount, FlatIntersectionSet(mesh));
+
+        parallelFor(blocksCount, threadsCount, [&](std::size_t blockIndex) {
+            impl::FlatIntersectionsCollector collector{blocks[blockIndex]};
+            auto end = std::min(initialDirections.size(), (blockIndex + 1) * blockSize);
+            for (auto rayIndex = blockIndex * blockSize; rayIndex < end; ++rayIndex) {
+                impl::traceRay(
+                        mesh,
+                        initialDirections[rayIndex],
+                        rayIndex,
+                        impl::DirectionFunctions{findDirection},
+                        findIntersection,
+                        stopCondition,
+                        collector,
+                        errLog
+                );
+            }
+        });
+
+        FlatIntersectionSet result(mesh);
+        result.append(std::move(blocks), threadsCount);
+        return result;
+    }
+}
+
+#endif //RAYTRACER_FLAT_INTERSECTION_SET_H
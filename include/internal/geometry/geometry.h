@@ -2,7 +2,10 @@
 #define RAYTRACER_GEOMETRY_H
 
 #include "geometry_primitives.h"
+#include "boundary_index.h"
+#include "nodal_field.h"
 #include "intersection.h"
+#include "flat_intersection_set.h"
 #include "mesh.h"
 
 #endif //RAYTRACER_GEOMETRY_H
@@ -1,6 +1,7 @@
 #ifndef RAYTRACER_GEOMETRY_PRIMITIVES_H
 #define RAYTRACER_GEOMETRY_PRIMITIVES_H
 
+#include <cstdint>
 #include <vector>
 #include <ostream>
 #include <cmath>
@@ -249,8 +250,12 @@ namespace raytracer {
          */
         const Face *face;
 
-        /** Unique identification */
-        int id;
+        /**
+         * Identification of a crossing. Crossings found by tracing a ray have the id given by getCrossingId,
+         * which depends only on the index of the ray and of the crossing, so the ids are unique within
+         * a single tracing call only. Points found outside of tracing have a negative id.
+         */
+        std::int64_t id;
     };
 
     /**
@@ -1,6 +1,9 @@
 #ifndef RAYTRACER_GEOMETRY_FUNCTIONS_H
 #define RAYTRACER_GEOMETRY_FUNCTIONS_H
 
+#include <atomic>
+#include <limits>
+#include <tuple>
 #include <utility.h>
 #include "mesh.h"
 
@@ -40,20 +43,166 @@ namespace raytracer {
     /** Sequence of sequences of intersections */
     using IntersectionSet = std::vector<Intersections>;
 
+    /**
+     * Tolerance policy of findExitPoint.
+     */
+    struct IntersectionTolerance {
+        /**
+         * Faces are extended by edge times their length at both ends, so that a ray passing exactly
+         * through a vertex is not lost to rounding. Zero means the face is taken exactly.
+         */
+        double edge{0};
+
+        /**
+         * If no face is hit in front of the ray origin, accept a face passing through the origin itself.
+         */
+        bool includeOrigin{true};
+    };
+
+    namespace impl {
+        /**
+         * Intersect the ray with a face given by two points.
+         * @param ray
+         * @param rayNormal normal of the ray direction
+         * @param face
+         * @param kMin lowest allowed position on the face, 0 is the first point
+         * @param kMax highest allowed position on the face, 1 is the second point
+         * @param point the intersection point, set only if true is returned
+         * @param t ray parameter of the intersection (distance in multiples of the direction)
+         * @return true if the lines intersect within [kMin, kMax]
+         */
+        bool intersectFace(
+                const Ray &ray,
+                const Vector &rayNormal,
+                const Face &face,
+                double kMin,
+                double kMax,
+                Point &point,
+                double &t
+        );
+
+        /**
+         * Closest face hit by a ray out of the faces added. Hits in front of the origin take precedence
+         * over hits at the origin, equally distant hits are resolved by taking the higher order.
+         */
+        class ClosestFaceHit {
+        public:
+            /**
+             * Consider a hit found by intersectFace
+             * @param ray
+             * @param face
+             * @param order position of the face used to break ties
+             * @param point
+             * @param t
+             * @param includeOrigin whether hits at t = 0 count
+             */
+            void add(
+                    const Ray &ray,
+                    const Face *face,
+                    std::size_t order,
+                    const Point &point,
+                    double t,
+                    bool includeOrigin
+            );
+
+            /** @return squared distance of the closest hit in front of the origin, infinity if none */
+            double getDistance2() const { return hitDistance2; }
+
+            /**
+             * Write the closest hit to result and give it a new id.
+             * @param result
+             * @return false if nothing was hit
+             */
+            bool get(PointOnFace &result) const;
+
+        private:
+            const Face *hitFace{};
+            Point hitPoint{};
+            double hitDistance2{std::numeric_limits<double>::infinity()};
+            std::size_t hitOrder{};
+            const Face *touchFace{};
+            Point touchPoint{};
+            double touchDistance2{std::numeric_limits<double>::infinity()};
+            std::size_t touchOrder{};
+        };
+    }
+
+    /**
+     * Find the closest point where the ray hits one of the faces without allocating anything.
+     * All faces are checked in a single pass, if two hits are equally distant the later face wins.
+     * @param ray
+     * @param faces to search, typically the faces of the element the ray is in
+     * @param skippedFace face that is not considered, typically the one the ray entered through, may be nullptr
+     * @param result PointOnFace that is filled in if a hit is found
+     * @param tolerance
+     * @return true if a hit was found
+     */
+    bool findExitPoint(
+            const Ray &ray,
+            ArrayView<Face *> faces,
+            const Face *skippedFace,
+            PointOnFace &result,
+            const IntersectionTolerance &tolerance = IntersectionTolerance{}
+    );
+
     /**
      * Given a set of face find the closest intersection of the ray with on of the faces or return nullptr
      * @param ray
      * @param faces
      * @return
      */
-    PointOnFacePtr findClosestIntersectionPoint(const Ray &ray, const std::vector<Face *> &faces);
+    PointOnFacePtr findClosestIntersectionPoint(const Ray &ray, ArrayView<Face *> faces);
 
+    /**
+     * Counters of rays whose tracing ended prematurely. The counters are atomic so that
+     * a single log can be shared by all threads tracing in parallel.
+     */
     struct InterErrLog {
-        std::size_t tooLong{0};
-        std::size_t stuck{0};
-        std::size_t notFound{0};
+        /** Rays that had too many intersections */
+        std::atomic<std::size_t> tooLong{0};
+        /** Rays that got stuck in a single element */
+        std::atomic<std::size_t> stuck{0};
+        /** Rays for which the next intersection could not be found */
+        std::atomic<std::size_t> notFound{0};
+        /** Rays stopped because their power fell below the threshold, see StopAtPower */
+        std::atomic<std::size_t> powerCutOff{0};
+        /** Rays stopped by the russian roulette, see StopAtPower */
+        std::atomic<std::size_t> rouletteKilled{0};
+        /** Russian roulettes won, a ray can win several times */
+        std::atomic<std::size_t> rouletteSurvived{0};
     };
 
+    /**
+     * Maximal number of intersections of a single ray, its tracing ends afterwards
+     */
+    constexpr std::size_t maxRayIntersectionsCount = 10001;
+
+    /**
+     * Deterministic id of a crossing found by tracing
+     * @param rayIndex index of the ray
+     * @param crossingIndex index of the crossing along the ray, less than maxRayIntersectionsCount
+     * @return id of the PointOnFace
+     */
+    inline std::int64_t getCrossingId(std::size_t rayIndex, std::size_t crossingIndex) {
+        return static_cast<std::int64_t>(rayIndex * maxRayIntersectionsCount + crossingIndex);
+    }
+
+    /**
+     * @param crossingId id given by getCrossingId
+     * @return index of the ray
+     */
+    inline std::size_t getCrossingRayIndex(std::int64_t crossingId) {
+        return static_cast<std::size_t>(crossingId) / maxRayIntersectionsCount;
+    }
+
+    /**
+     * @param crossingId id given by getCrossingId
+     * @return index of the crossing along the ray
+     */
+    inline std::size_t getCrossingIndex(std::int64_t crossingId) {
+        return static_cast<std::size_t>(crossingId) % maxRayIntersectionsCount;
+    }
+
     using DirectionFunction = std::function<tl::optional<Vector>(PointOnFace, Vector)>;
 
     /**
@@ -72,6 +221,10 @@ namespace raytracer {
      * @param findDirection function of type DirectionFunction
      * @param findIntersection function of type IntersectionFunction
      * @param stopCondition function of type StopCondition
+     * @param errLog optional log of rays that ended prematurely
+     * @param threadsCount number of threads tracing the rays concurrently, 0 means all hardware threads.
+     * If more than one thread is used, the functions given must be safe to call concurrently.
+     * The result is the same as in the serial case, ordered as initialDirections.
      * @return Set of intersections
      */
     template<typename IntersectionFunction, typename StopCondition>
@@ -80,7 +233,79 @@ namespace raytracer {
                                       const std::vector<DirectionFunction> &findDirection,
                                       IntersectionFunction &&findIntersection,
                                       StopCondition &&stopCondition,
-                                      InterErrLog *errLog = nullptr
+                                      InterErrLog *errLog = nullptr,
+                                      unsigned threadsCount = 1
+    );
+
+    /**
+     * Same as findIntersections, but the direction functions are given as a tuple and tried in order.
+     * Unlike the std::vector<DirectionFunction> version the calls are resolved at compile time, so the
+     * whole chain, e.g. std::make_tuple(totalReflect, reflectOnCritical, snellsLaw), can be inlined
+     * into the tracing loop.
+     * @tparam DirectionFunctions types callable as tl::optional<Vector>(const PointOnFace&, const Vector&)
+     * @return Set of intersections
+     */
+    template<typename IntersectionFunction, typename StopCondition, typename... DirectionFunctions>
+    IntersectionSet findIntersections(const Mesh &mesh,
+                                      const std::vector<Ray> &initialDirections,
+                                      std::tuple<DirectionFunctions...> findDirection,
+                                      IntersectionFunction &&findIntersection,
+                                      StopCondition &&stopCondition,
+                                      InterErrLog *errLog = nullptr,
+                                      unsigned threadsCount = 1
+    );
+
+    /**
+     * Trace the rays the same way findIntersections does, but instead of storing the intersections
+     * hand each of them to the visitor as soon as it is found. This way the intersections can be
+     * processed (absorbed, written out...) on the fly without ever holding the whole IntersectionSet.
+     * @tparam RayVisitor type providing the methods
+     *      bool onIntersection(std::size_t rayIndex, const Intersection *previous, const Intersection &current)
+     *      - called for every intersection in order, previous is nullptr for the first one of a ray,
+     *      return false to stop tracing the ray;
+     *      void onRayEnd(std::size_t rayIndex)
+     *      - called once the ray is finished.
+     * If more than one thread is used the visitor is called concurrently for different rays, but the calls
+     * for one ray always come from a single thread.
+     * @param mesh
+     * @param initialDirections rays incident on the mesh
+     * @param findDirection function of type DirectionFunction
+     * @param findIntersection function of type IntersectionFunction
+     * @param stopCondition function of type StopCondition
+     * @param visitor of type RayVisitor
+     * @param errLog optional log of rays that ended prematurely
+     * @param threadsCount number of threads tracing the rays concurrently, 0 means all hardware threads.
+     */
+    template<typename IntersectionFunction, typename StopCondition, typename RayVisitor>
+    void traceRays(const Mesh &mesh,
+                   const std::vector<Ray> &initialDirections,
+                   const std::vector<DirectionFunction> &findDirection,
+                   IntersectionFunction &&findIntersection,
+                   StopCondition &&stopCondition,
+                   RayVisitor &&visitor,
+                   InterErrLog *errLog = nullptr,
+                   unsigned threadsCount = 1
+    );
+
+    /**
+     * Same as traceRays, but with direction functions given as a tuple, see findIntersections.
+     */
+    template<typename IntersectionFunction, typename StopCondition, typename RayVisitor,
+            typename... DirectionFunctions>
+    void traceRays(const Mesh &mesh,
+                   const std::vector<Ray> &initialDirections,
+                   std::tuple<DirectionFunctions...> findDirection,
+                   IntersectionFunction &&findIntersection,
+                   StopCondition &&stopCondition,
+                   RayVisitor &&visitor,
+                   InterErrLog *errLog = nullptr,
+                   unsigned threadsCount = 1
+    );
+
+    tl::optional<Vector> calcDirection(
+            const std::vector<DirectionFunction> &findDirection,
+            const PointOnFace &pointOnFace,
+            const Vector &prevDirection
     );
 
     //End of header, template garbage follows---------------------------------------------------------------------------
@@ -89,15 +314,94 @@ namespace raytracer {
 
 
     namespace impl {
-        template<typename IntersectionFunction, typename StopCondition>
-        Intersections findRayIntersections(
+        template<typename DirectionFunc, typename IntersectionFunction, typename StopCondition, typename RayVisitor>
+        void traceRay(
                 const Mesh &mesh,
                 const Ray &initialDirection,
-                const std::vector<DirectionFunction> &findDirection,
+                std::size_t rayIndex,
+                DirectionFunc &&findDirection,
                 IntersectionFunction &&findIntersection,
                 StopCondition &&stopCondition,
+                RayVisitor &&visitor,
                 InterErrLog *errLog = nullptr
         );
+
+        template<typename DirectionFunc, typename IntersectionFunction, typename StopCondition, typename RayVisitor>
+        void traceRays(
+                const Mesh &mesh,
+                const std::vector<Ray> &initialDirections,
+                DirectionFunc &&findDirection,
+                IntersectionFunction &&findIntersection,
+                StopCondition &&stopCondition,
+                RayVisitor &&visitor,
+                InterErrLog *errLog,
+                unsigned threadsCount
+        ) {
+            parallelFor(initialDirections.size(), threadsCount, [&](std::size_t rayIndex) {
+                impl::traceRay(
+                        mesh,
+                        initialDirections[rayIndex],
+                        rayIndex,
+                        findDirection,
+                        findIntersection,
+                        stopCondition,
+                        visitor,
+                        errLog
+                );
+            });
+        }
+
+        struct IntersectionsCollector {
+            IntersectionSet &intersectionSet;
+
+            bool onIntersection(std::size_t rayIndex, const Intersection *, const Intersection &current) {
+                intersectionSet[rayIndex].emplace_back(current);
+                return true;
+            }
+
+            void onRayEnd(std::size_t) {}
+        };
+
+        /** Runtime chain of direction functions, see calcDirection */
+        struct DirectionFunctions {
+            const std::vector<DirectionFunction> &functions;
+
+            tl::optional<Vector> operator()(const PointOnFace &pointOnFace, const Vector &direction) const {
+                return calcDirection(functions, pointOnFace, direction);
+            }
+        };
+
+        template<std::size_t Index, std::size_t Size>
+        struct DirectionChainStep {
+            template<typename Functions>
+            static tl::optional<Vector> apply(
+                    Functions &functions,
+                    const PointOnFace &pointOnFace,
+                    const Vector &direction
+            ) {
+                tl::optional<Vector> result = std::get<Index>(functions)(pointOnFace, direction);
+                if (result) return result;
+                return DirectionChainStep<Index + 1, Size>::apply(functions, pointOnFace, direction);
+            }
+        };
+
+        template<std::size_t Size>
+        struct DirectionChainStep<Size, Size> {
+            template<typename Functions>
+            static tl::optional<Vector> apply(Functions &, const PointOnFace &, const Vector &) {
+                return {};
+            }
+        };
+
+        /** Compile time chain of direction functions, the first one returning a direction wins */
+        template<typename... Functions>
+        struct DirectionChain {
+            std::tuple<Functions...> functions;
+
+            tl::optional<Vector> operator()(const PointOnFace &pointOnFace, const Vector &direction) {
+                return DirectionChainStep<0, sizeof...(Functions)>::apply(functions, pointOnFace, direction);
+            }
+        };
     }
 
 
@@ -108,70 +412,135 @@ namespace raytracer {
             const std::vector<DirectionFunction> &findDirection,
             IntersectionFunction &&findIntersection,
             StopCondition &&stopCondition,
-            InterErrLog *errLog
+            InterErrLog *errLog,
+            unsigned threadsCount
     ) {
-        IntersectionSet result;
-        result.reserve(initialDirections.size());
-
-        for (const auto &initialDirection : initialDirections) {
-            result.emplace_back(impl::findRayIntersections(
-                    mesh,
-                    initialDirection,
-                    findDirection,
-                    std::forward<IntersectionFunction>(findIntersection),
-                    std::forward<StopCondition>(stopCondition),
-                    errLog
-            ));
-        }
+        IntersectionSet result(initialDirections.size());
+        impl::traceRays(
+                mesh,
+                initialDirections,
+                impl::DirectionFunctions{findDirection},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                impl::IntersectionsCollector{result},
+                errLog,
+                threadsCount
+        );
         return result;
     }
 
-    tl::optional<Vector> calcDirection(
-            const std::vector<DirectionFunction> &findDirection,
-            const PointOnFace &pointOnFace,
-            const Vector &prevDirection
-    );
+    template<typename IntersectionFunction, typename StopCondition, typename... DirectionFunctions>
+    IntersectionSet findIntersections(
+            const Mesh &mesh,
+            const std::vector<Ray> &initialDirections,
+            std::tuple<DirectionFunctions...> findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            InterErrLog *errLog,
+            unsigned threadsCount
+    ) {
+        IntersectionSet result(initialDirections.size());
+        impl::traceRays(
+                mesh,
+                initialDirections,
+                impl::DirectionChain<DirectionFunctions...>{std::move(findDirection)},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                impl::IntersectionsCollector{result},
+                errLog,
+                threadsCount
+        );
+        return result;
+    }
 
-    template<typename IntersectionFunction, typename StopCondition>
-    Intersections impl::findRayIntersections(
+    template<typename IntersectionFunction, typename StopCondition, typename RayVisitor>
+    void traceRays(
             const Mesh &mesh,
-            const Ray &initialDirection,
+            const std::vector<Ray> &initialDirections,
             const std::vector<DirectionFunction> &findDirection,
             IntersectionFunction &&findIntersection,
             StopCondition &&stopCondition,
-            InterErrLog *errLog
+            RayVisitor &&visitor,
+            InterErrLog *errLog,
+            unsigned threadsCount
     ) {
-        Intersections result;
-        PointOnFacePtr initialPointOnFace = findClosestIntersectionPoint(
-                initialDirection,
-                mesh.getBoundary()
+        impl::traceRays(
+                mesh,
+                initialDirections,
+                impl::DirectionFunctions{findDirection},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                std::forward<RayVisitor>(visitor),
+                errLog,
+                threadsCount
         );
+    }
+
+    template<typename IntersectionFunction, typename StopCondition, typename RayVisitor,
+            typename... DirectionFunctions>
+    void traceRays(
+            const Mesh &mesh,
+            const std::vector<Ray> &initialDirections,
+            std::tuple<DirectionFunctions...> findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            RayVisitor &&visitor,
+            InterErrLog *errLog,
+            unsigned threadsCount
+    ) {
+        impl::traceRays(
+                mesh,
+                initialDirections,
+                impl::DirectionChain<DirectionFunctions...>{std::move(findDirection)},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                std::forward<RayVisitor>(visitor),
+                errLog,
+                threadsCount
+        );
+    }
 
-        if (!initialPointOnFace)
+    template<typename DirectionFunc, typename IntersectionFunction, typename StopCondition, typename RayVisitor>
+    void impl::traceRay(
+            const Mesh &mesh,
+            const Ray &initialDirection,
+            std::size_t rayIndex,
+            DirectionFunc &&findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            RayVisitor &&visitor,
+            InterErrLog *errLog
+    ) {
+        PointOnFace initialPointOnFace{};
+        if (!mesh.getBoundaryIndex().findEntryPoint(initialDirection, initialPointOnFace))
             throw std::logic_error("No intersection found! Did you miss the target?");
+        initialPointOnFace.id = getCrossingId(rayIndex, 0);
 
         Intersection previousIntersection{};
         previousIntersection.nextElement = mesh.getFaceDirAdjElement(
-                initialPointOnFace->face,
+                initialPointOnFace.face,
                 initialDirection.direction
         );
         if (!previousIntersection.nextElement) throw std::logic_error("Could not find next element at border!");
         previousIntersection.previousElement = nullptr;
-        previousIntersection.pointOnFace = *initialPointOnFace;
-        previousIntersection.direction = calcDirection(
-                findDirection,
-                *initialPointOnFace,
+        previousIntersection.pointOnFace = initialPointOnFace;
+        previousIntersection.direction = findDirection(
+                initialPointOnFace,
                 initialDirection.direction
         ).value();
 
-        result.emplace_back(previousIntersection);
-        if (previousIntersection.direction * initialDirection.direction < 0) {
-            return result;
+        std::size_t intersectionsCount = 1;
+        bool visitorContinues = visitor.onIntersection(rayIndex, nullptr, previousIntersection);
+        if (!visitorContinues || previousIntersection.direction * initialDirection.direction < 0) {
+            visitor.onRayEnd(rayIndex);
+            return;
         }
 
-        while (result.back().nextElement && !stopCondition(*(result.back().nextElement))) {
+        // Number of the latest consecutive intersections that entered the same element they came from
+        std::size_t sameElementCount = 0;
+        while (previousIntersection.nextElement && !stopCondition(*(previousIntersection.nextElement))) {
 
-            if (result.size() > 10000) {
+            if (intersectionsCount >= maxRayIntersectionsCount) {
                 if (errLog) {
                     errLog->tooLong++;
                 }
@@ -190,9 +559,9 @@ namespace raytracer {
                 }
                 break;
             }
+            nextPointOnFace.id = getCrossingId(rayIndex, intersectionsCount);
 
-            auto direction = calcDirection(
-                    findDirection,
+            auto direction = findDirection(
                     nextPointOnFace, //At which point
                     previousIntersection.direction //Previous direction
             );
@@ -206,36 +575,29 @@ namespace raytracer {
                 );
                 intersection.nextElement = nextElementToGo;
                 intersection.direction = direction.value();
-                result.emplace_back(intersection);
             } else {
                 intersection.nextElement = nullptr;
                 intersection.direction = previousIntersection.direction;
-                result.emplace_back(intersection);
-                break;
             }
+            intersectionsCount++;
+            visitorContinues = visitor.onIntersection(rayIndex, &previousIntersection, intersection);
+            if (!direction || !visitorContinues) break;
 
-            previousIntersection = intersection;
-
-            if (result.size() > 15) {
-                const Element *possiblyStuck = intersection.previousElement;
-                bool stuck = true;
-                for (auto it = next(result.rbegin()); it != result.rbegin() + 10; it++) {
-                    if (!(it->previousElement == it->nextElement && it->previousElement == possiblyStuck)) {
-                        stuck = false;
-                        break;
-                    }
-                }
-                if (stuck) {
-                    if (errLog) {
-                        errLog->stuck++;
-                    }
-                    break;
+            if (intersectionsCount > 15 && sameElementCount >= 9) {
+                if (errLog) {
+                    errLog->stuck++;
                 }
+                break;
+            }
+            if (intersection.previousElement == intersection.nextElement) {
+                sameElementCount++;
+            } else {
+                sameElementCount = 0;
             }
 
+            previousIntersection = intersection;
         }
-
-        return result;
+        visitor.onRayEnd(rayIndex);
     }
 }
 
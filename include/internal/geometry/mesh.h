@@ -4,6 +4,7 @@
 #include <vector>
 #include <memory>
 #include "geometry_primitives.h"
+#include "boundary_index.h"
 #include "mfem.hpp"
 
 
@@ -30,6 +31,20 @@ namespace raytracer {
 
         virtual std::pair<Element *, Element *> getFaceAdjElements(const Face *face) const = 0;
 
+        /**
+         * Override this.
+         * @param id of the face
+         * @return the face with given id
+         */
+        virtual Face *getFaceFromId(int id) const = 0;
+
+        /**
+         * Override this.
+         * @param id of the element
+         * @return the element with given id or nullptr if id is negative
+         */
+        virtual Element *getElementFromId(int id) const = 0;
+
         virtual std::vector<Element *> getPointAdjOrderedElements(const Point *point) const = 0;
 
         virtual std::vector<Face *> getPointAdjOrderedFaces(const Point *point) const = 0;
@@ -49,34 +64,40 @@ namespace raytracer {
          * Override this.
          * @return
          */
-        virtual std::vector<Face *> getBoundary() const = 0;
+        virtual ArrayView<Face *> getBoundary() const = 0;
+
+        /**
+         * Override this.
+         * @return index over the faces returned by getBoundary()
+         */
+        virtual const BoundaryIndex &getBoundaryIndex() const = 0;
 
         /**
          * Override this.
          * @return
          */
-        virtual std::vector<Point *> getInnerPoints() const = 0;
+        virtual ArrayView<Point *> getInnerPoints() const = 0;
 
-        virtual std::vector<Point *> getBoundaryPoints() const = 0;
+        virtual ArrayView<Point *> getBoundaryPoints() const = 0;
 
         /**
          * Override this.
          * @return
          */
-        virtual std::vector<Point *> getPoints() const = 0;
+        virtual ArrayView<Point *> getPoints() const = 0;
 
         /**
          * Override this.
          * @return
          */
-        virtual std::vector<Element *> getElements() const = 0;
+        virtual ArrayView<Element *> getElements() const = 0;
 
         /**
          * Override this.
          * @param point
          * @return
          */
-        virtual std::vector<Element *> getPointAdjacentElements(const Point *point) const = 0;
+        virtual ArrayView<Element *> getPointAdjacentElements(const Point *point) const = 0;
     };
 
     /**
@@ -87,21 +108,31 @@ namespace raytracer {
     public:
         /**
          * Encapsulate an mfem mesh while not owning it
+         * @param mesh
+         * @param threadsCount - threads used to fill the plain adjacency and normal arrays,
+         * 0 means all hardware threads. mfem is only ever called from the calling thread.
          */
-        explicit MfemMesh(mfem::Mesh *mesh);
+        explicit MfemMesh(mfem::Mesh *mesh, unsigned threadsCount = 1);
 
         /**
          * Load an mfem mesh from file (vtk or mfem native)
          * @param filename
          * @param generateEdges - see mfem docs
          * @param refine - see mfem docs
+         * @param threadsCount - same as in MfemMesh(mfem::Mesh *, unsigned)
          */
-        explicit MfemMesh(const std::string &filename, bool generateEdges = true, bool refine = false);
+        explicit MfemMesh(
+                const std::string &filename,
+                bool generateEdges = true,
+                bool refine = false,
+                unsigned threadsCount = 1
+        );
 
         MfemMesh(
                 SegmentedLine sideA,
                 SegmentedLine sideB,
-                mfem::Element::Type elementType = mfem::Element::Type::QUADRILATERAL
+                mfem::Element::Type elementType = mfem::Element::Type::QUADRILATERAL,
+                unsigned threadsCount = 1
         );
 
         /** Given a Face return the adjacent Element to this face in given direction.
@@ -114,8 +145,25 @@ namespace raytracer {
          */
         Element *getFaceDirAdjElement(const Face *face, const Vector &direction) const override;
 
+        /**
+         * Return the elements adjacent to the face, looked up in a table built on init().
+         * @param face
+         * @return pair of elements as ordered by mfem, either may be nullptr at the boundary
+         */
         std::pair<Element *, Element *> getFaceAdjElements(const Face *face) const override;
 
+        /**
+         * Return the unit normal of the face cached on init() and updateMesh().
+         * It points from the first adjacent element to the second one.
+         * @param face
+         * @return unit normal
+         */
+        const Vector &getFaceUnitNormal(const Face *face) const;
+
+        Face *getFaceFromId(int id) const override;
+
+        Element *getElementFromId(int id) const override;
+
         std::vector<Face *> getPointAdjOrderedFaces(const Point *point) const override;
 
         std::vector<Element *> getPointAdjOrderedElements(const Point *point) const override;
@@ -147,33 +195,40 @@ namespace raytracer {
          * Return faces that are on the mesh boundary.
          * @return vector of faces.
          */
-        std::vector<Face *> getBoundary() const override;
+        ArrayView<Face *> getBoundary() const override;
+
+        /**
+         * Return the index used to find where rays enter the mesh.
+         * It is rebuilt on updateMesh().
+         * @return index over the boundary faces
+         */
+        const BoundaryIndex &getBoundaryIndex() const override;
 
         /**
          * Return points that are not on the boundary of the mesh
          * @return sequence of points
          */
-        std::vector<Point *> getInnerPoints() const override;
-        std::vector<Point *> getBoundaryPoints() const override;
+        ArrayView<Point *> getInnerPoints() const override;
+        ArrayView<Point *> getBoundaryPoints() const override;
 
         /**
          * Return all mesh points
          * @return sequence of points
          */
-        std::vector<Point *> getPoints() const override;
+        ArrayView<Point *> getPoints() const override;
 
         /**
          * Return all mesh elements
          * @return
          */
-        std::vector<Element *> getElements() const override;
+        ArrayView<Element *> getElements() const override;
 
         /**
          * Return elements that do share a point
          * @param point
          * @return sequence of elements
          */
-        std::vector<Element *> getPointAdjacentElements(const Point *point) const override;
+        ArrayView<Element *> getPointAdjacentElements(const Point *point) const override;
 
         /**
          * Get pointer to the underlying mfem::Mesh
@@ -190,15 +245,21 @@ namespace raytracer {
     private:
         std::unique_ptr<mfem::Mesh> mfemMesh;
         mfem::Mesh *mesh;
+        unsigned threadsCount;
         std::vector<Face *> boundaryFaces;
+        BoundaryIndex boundaryIndex;
+        std::vector<std::pair<Element *, Element *>> facesAdjElements;
+        std::vector<Vector> facesUnitNormals;
         std::vector<std::unique_ptr<Element>> elements;
         std::vector<std::unique_ptr<Face>> faces;
         std::vector<std::unique_ptr<Point>> points;
+        std::vector<Point *> pointPointers;
+        std::vector<Element *> elementPointers;
         std::vector<Point *> innerPoints;
         std::vector<Point*> boundaryPoints;
         mutable mfem::Table elementToElementTable;
-        std::unique_ptr<mfem::Table> vertexToElementTable;
-        std::map<const Point *, std::vector<Element *>> pointsAdjacentElements;
+        std::vector<std::size_t> pointsAdjElementsOffsets;
+        std::vector<Element *> pointsAdjElements;
 
         std::unique_ptr<Point> createPointFromId(int id) const;
 
@@ -210,8 +271,6 @@ namespace raytracer {
 
         std::vector<Face *> getFacesFromIds(const mfem::Array<int> &ids) const;
 
-        Element *getElementFromId(int id) const;
-
         std::vector<std::unique_ptr<Point>> genPoints();
 
         std::vector<std::unique_ptr<Face>> genFaces();
@@ -220,11 +279,13 @@ namespace raytracer {
 
         std::vector<Face *> genBoundaryFaces();
 
-        void setBoundaryAndInner();
+        std::vector<std::pair<Element *, Element *>> genFacesAdjElements() const;
+
+        std::vector<Vector> genFacesUnitNormals() const;
 
-        std::vector<Element *> precalcPointAdjacentElements(const Point *point) const;
+        void setBoundaryAndInner();
 
-        std::map<const Point *, std::vector<Element *>> genPointsAdjacentElements() const;
+        void setPointsAdjElements();
 
         void init();
 
@@ -0,0 +1,122 @@
+#ifndef RAYTRACER_NODAL_FIELD_H
+#define RAYTRACER_NODAL_FIELD_H
+
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "geometry_primitives.h"
+
+namespace raytracer {
+
+    /**
+     * Values at mesh points stored densely and indexed by the point id.
+     * Every slot remembers the point its value was set for, slots that were never set are invalid.
+     * This way a field defined only at some points (e.g. inner points only) can be stored while
+     * both the lookup and the validity check are a single array access.
+     * The ids of the points must be unique and non negative, typically the points of a single mesh.
+     * The field grows when a higher id is set, so concurrent writers must size it up front.
+     * @tparam T type of the values
+     */
+    template<typename T>
+    class NodalField {
+    public:
+        NodalField() = default;
+
+        /**
+         * Construct a field with all values invalid
+         * @param pointsCount number of slots, the field grows automatically if a higher id is used
+         */
+        explicit NodalField(std::size_t pointsCount) : points(pointsCount, nullptr), values(pointsCount) {}
+
+        /**
+         * Construct a field with given values
+         * @param pointValues pairs of point and its value
+         */
+        NodalField(std::initializer_list<std::pair<Point *, T>> pointValues) {
+            for (const auto &pointValue : pointValues) {
+                (*this)[pointValue.first] = pointValue.second;
+            }
+        }
+
+        /**
+         * Access the value at point making it valid
+         * @param point
+         * @return reference to the value, default constructed if it was invalid
+         * @throws std::logic_error if the id is negative or another point with the same id has a value
+         */
+        T &operator[](Point *point) {
+            if (point->id < 0) throw std::logic_error("Nodal field point id must not be negative!");
+            auto id = static_cast<std::size_t>(point->id);
+            if (id >= points.size()) {
+                points.resize(id + 1, nullptr);
+                values.resize(id + 1);
+            }
+            if (!points[id]) {
+                points[id] = point;
+            } else if (points[id] != point) {
+                throw std::logic_error("Another point with the same id already has a value in the nodal field!");
+            }
+            return values[id];
+        }
+
+        /**
+         * Get the value at point
+         * @param point
+         * @return pointer to the value or nullptr if the value at point is invalid
+         */
+        const T *find(const Point *point) const {
+            if (point->id < 0) return nullptr;
+            auto id = static_cast<std::size_t>(point->id);
+            if (id >= points.size() || points[id] != point) return nullptr;
+            return &values[id];
+        }
+
+        /**
+         * Get the value at point
+         * @param point
+         * @return reference to the value
+         * @throws std::out_of_range if the value at point is invalid
+         */
+        const T &at(const Point *point) const {
+            auto value = find(point);
+            if (!value) throw std::out_of_range("No value at given point!");
+            return *value;
+        }
+
+        /**
+         * @param point
+         * @return 1 if the value at point is valid, 0 otherwise
+         */
+        std::size_t count(const Point *point) const {
+            return find(point) ? 1 : 0;
+        }
+
+        /** @return number of slots, i.e. highest point id + 1 */
+        std::size_t getSlotsCount() const {
+            return points.size();
+        }
+
+        /**
+         * @param id point id
+         * @return the point whose value is stored in slot id or nullptr if the slot is invalid
+         */
+        Point *getPoint(std::size_t id) const {
+            return points[id];
+        }
+
+        /**
+         * @param id point id
+         * @return value stored in slot id, meaningful only if the slot is valid
+         */
+        const T &getValue(std::size_t id) const {
+            return values[id];
+        }
+
+    private:
+        std::vector<Point *> points;
+        std::vector<T> values;
+    };
+}
+
+#endif //RAYTRACER_NODAL_FIELD_H
@@ -3,11 +3,15 @@
 
 #include <geometry.h>
 
+#include <memory>
+#include <mutex>
+#include <tuple>
 #include <utility>
 #include "magnitudes.h"
 #include "gradient.h"
 #include "refraction.h"
 #include "laser.h"
+#include "termination.h"
 
 namespace raytracer {
     /**
@@ -29,6 +33,25 @@ namespace raytracer {
                 const Power &currentPower
         ) const = 0;
 
+        /**
+         * Same as getPowerChange, but the previous intersection is given by pointer, so it need not be copied
+         * into an optional. The default calls getPowerChange, the models of this library override it as final,
+         * so StaticPowerExchangeController calls them directly.
+         * @param previousIntersection nullptr for the first intersection of a ray
+         * @param currentIntersection
+         * @param currentPower
+         * @return power gained by plasma (power lost by plasma is negative)
+         */
+        virtual double calcPowerChange(
+                const Intersection *previousIntersection,
+                const Intersection &currentIntersection,
+                double currentPower
+        ) const {
+            tl::optional<Intersection> previous;
+            if (previousIntersection) previous = *previousIntersection;
+            return getPowerChange(previous, currentIntersection, Power{currentPower}).asDouble;
+        }
+
         /**
          * Name the model.
          * @return
@@ -56,12 +79,31 @@ namespace raytracer {
                 const tl::optional<Intersection> &previousIntersection,
                 const raytracer::Intersection &currentIntersection,
                 const raytracer::Power &currentPower) const override {
-            if (!previousIntersection) return {0};
+            return raytracer::Power{calcPowerChange(
+                    previousIntersection ? &previousIntersection.value() : nullptr,
+                    currentIntersection,
+                    currentPower.asDouble
+            )};
+        }
+
+        /**
+         * getPowerChange without the optional, see PowerExchangeModel::calcPowerChange
+         * @param previousIntersection nullptr for the first intersection of a ray
+         * @param currentIntersection
+         * @param currentPower
+         * @return power gained by plasma (power lost by plasma is negative)
+         */
+        double calcPowerChange(
+                const Intersection *previousIntersection,
+                const Intersection &currentIntersection,
+                double currentPower
+        ) const final {
+            if (!previousIntersection) return 0;
             auto distance = (currentIntersection.pointOnFace.point -
-                             previousIntersection.value().pointOnFace.point).getNorm();
+                             previousIntersection->pointOnFace.point).getNorm();
             auto element = currentIntersection.previousElement;
             auto gainCoeff = gain[element->getId()];
-            return raytracer::Power{currentPower.asDouble * (1 - std::exp(gainCoeff * distance))};
+            return currentPower * (1 - std::exp(gainCoeff * distance));
         }
 
         /**
@@ -108,6 +150,19 @@ namespace raytracer {
         getPowerChange(const tl::optional<Intersection> &previousIntersection, const Intersection &currentIntersection,
                        const Power &currentPower) const override;
 
+        /**
+         * getPowerChange without the optional, see PowerExchangeModel::calcPowerChange
+         * @param previousIntersection nullptr for the first intersection of a ray
+         * @param currentIntersection
+         * @param currentPower
+         * @return power change
+         */
+        double calcPowerChange(
+                const Intersection *previousIntersection,
+                const Intersection &currentIntersection,
+                double currentPower
+        ) const final;
+
         /**
          * Returns "Resonance"
          * @return
@@ -129,6 +184,11 @@ namespace raytracer {
             return Power{0};
         }
 
+        /** getPowerChange without the optional, see PowerExchangeModel::calcPowerChange */
+        double calcPowerChange(const Intersection *, const Intersection &, double) const final {
+            return 0;
+        }
+
         std::string getName() const override {
             return "Zero exchange";
         }
@@ -146,13 +206,24 @@ namespace raytracer {
 
         Power getPowerChange(const tl::optional<Intersection> &, const Intersection &currentIntersection,
                              const Power &currentPower) const override {
+            return Power{calcPowerChange(nullptr, currentIntersection, currentPower.asDouble)};
+        }
+
+        /**
+         * getPowerChange without the optional, see PowerExchangeModel::calcPowerChange
+         * @param currentIntersection
+         * @param currentPower
+         * @return power change
+         */
+        double calcPowerChange(const Intersection *, const Intersection &currentIntersection,
+                               double currentPower) const final {
             if (reflectedMarker->isMarked(currentIntersection.pointOnFace)) {
                 if (!currentIntersection.nextElement) {
-                    return {0};
+                    return 0;
                 }
                 double n2 = refractIndex[currentIntersection.nextElement->getId()];
                 if (n2 <= 0) {
-                    return Power{0};
+                    return 0;
                 }
                 double n1 = 1.0;
                 auto normal = currentIntersection.pointOnFace.face->getNormal();
@@ -161,12 +232,12 @@ namespace raytracer {
                 dir = 1 / dir.getNorm() * dir;
                 auto cosInc = std::abs(dir * normal);
                 if (polarization == "s") {
-                    return {(1 - Rs(n1, n2, cosInc)) * currentPower.asDouble};
+                    return (1 - Rs(n1, n2, cosInc)) * currentPower;
                 } else {
-                    return {(1 - Rp(n1, n2, cosInc)) * currentPower.asDouble};
+                    return (1 - Rp(n1, n2, cosInc)) * currentPower;
                 }
             } else {
-                return {0};
+                return 0;
             }
         }
 
@@ -222,18 +293,37 @@ namespace raytracer {
                 const Intersection &currentIntersection,
                 const Power &currentPower
         ) const override {
-            if (!previousIntersection) return {0};
+            return Power{calcPowerChange(
+                    previousIntersection ? &previousIntersection.value() : nullptr,
+                    currentIntersection,
+                    currentPower.asDouble
+            )};
+        }
+
+        /**
+         * getPowerChange without the optional, see PowerExchangeModel::calcPowerChange
+         * @param previousIntersection nullptr for the first intersection of a ray
+         * @param currentIntersection
+         * @param currentPower
+         * @return power absorbed
+         */
+        double calcPowerChange(
+                const Intersection *previousIntersection,
+                const Intersection &currentIntersection,
+                double currentPower
+        ) const final {
+            if (!previousIntersection) return 0;
             const auto &element = currentIntersection.previousElement;
-            if (!element) return Power{0};
-            const auto &previousPoint = previousIntersection.value().pointOnFace.point;
+            if (!element) return 0;
+            const auto &previousPoint = previousIntersection->pointOnFace.point;
             const auto &point = currentIntersection.pointOnFace.point;
 
             const auto distance = (point - previousPoint).getNorm();
             auto coeff = bremssCoeff[element->getId()];
             const auto exponent = -coeff * distance;
 
-            auto newPower = currentPower.asDouble * std::exp(exponent);
-            return Power{currentPower.asDouble - newPower};
+            auto newPower = currentPower * std::exp(exponent);
+            return currentPower - newPower;
         }
 
         /**
@@ -250,10 +340,72 @@ namespace raytracer {
     /** Map of PowerExchangeModel pointers to powers */
     typedef std::map<const PowerExchangeModel *, Power> ModelPowers;
 
-    /** Map of PowerExchangeModel pointers to PowersSets.
-     * This means ModelPowersSets[&myModel][1][2] is the power
-     * absorbed by myModel in ray number 1 intersection number 2 */
-    typedef std::map<const PowerExchangeModel *, PowersSet> ModelPowersSets;
+    /**
+     * Powers exchanged by each model at each intersection of each ray.
+     * Powers of one model form a dense array laid out the same way as FlatIntersectionSet, i.e. the intersections
+     * of ray i span the flat indices [getRayBegin(i), getRayEnd(i)), and the arrays of the models follow each
+     * other. Models are referred to by their index, which is their order in PowerExchangeController::models.
+     * This means getPowers(1)[getRayBegin(2) + 3] is the power absorbed by the second model
+     * in ray number 2 intersection number 3.
+     */
+    class ModelPowersSets {
+    public:
+        ModelPowersSets() = default;
+
+        /**
+         * Construct zero powers
+         * @param models the models, their order gives the model index
+         * @param rayOffsets flat index of the first intersection of each ray followed by the total
+         * number of intersections, i.e. getRayBegin of all rays and getRayEnd of the last one
+         * @throws std::logic_error if the offsets are not ascending from zero
+         */
+        ModelPowersSets(std::vector<const PowerExchangeModel *> models, std::vector<std::size_t> rayOffsets);
+
+        /** @return number of models */
+        std::size_t getModelsCount() const { return models.size(); }
+
+        /** @return model at given index */
+        const PowerExchangeModel *getModel(std::size_t modelIndex) const { return models[modelIndex]; }
+
+        /** @return number of rays */
+        std::size_t getRaysCount() const { return rayOffsets.size() - 1; }
+
+        /** @return number of intersections of all rays */
+        std::size_t getIntersectionsCount() const { return rayOffsets.back(); }
+
+        /** @return flat index of the first intersection of the ray */
+        std::size_t getRayBegin(std::size_t rayIndex) const { return rayOffsets[rayIndex]; }
+
+        /** @return flat index past the last intersection of the ray */
+        std::size_t getRayEnd(std::size_t rayIndex) const { return rayOffsets[rayIndex + 1]; }
+
+        /** @return powers of the model at all flat indices */
+        double *getPowers(std::size_t modelIndex) {
+            return powers.data() + modelIndex * getIntersectionsCount();
+        }
+
+        /** @return powers of the model at all flat indices */
+        const double *getPowers(std::size_t modelIndex) const {
+            return powers.data() + modelIndex * getIntersectionsCount();
+        }
+
+        /** @return power of the model at intersection number intersectionIndex of ray number rayIndex */
+        Power getPower(std::size_t modelIndex, std::size_t rayIndex, std::size_t intersectionIndex) const {
+            return Power{getPowers(modelIndex)[getRayBegin(rayIndex) + intersectionIndex]};
+        }
+
+        /**
+         * Copy the powers of the model into nested PowersSet
+         * @param modelIndex
+         * @return powers of the model, [ray index][intersection index]
+         */
+        PowersSet getPowersSet(std::size_t modelIndex) const;
+
+    private:
+        std::vector<const PowerExchangeModel *> models;
+        std::vector<std::size_t> rayOffsets{0};
+        std::vector<double> powers;
+    };
 
     /** Summary of model-powers map and initialPower value. */
     struct AbsorptionSummary {
@@ -275,29 +427,522 @@ namespace raytracer {
 
         size_t getModelsCount() const;
 
-        ModelPowersSets genPowers(const IntersectionSet &intersectionSet, const Powers &initialPowers) const;
+        /**
+         * Run the models on all intersections of all rays, starting each ray with its initial power.
+         * @param intersectionSet
+         * @param initialPowers
+         * @param threadsCount number of threads the rays are spread over, 0 means all hardware threads.
+         * The models must be safe to call concurrently if more threads are used, the result does not depend on it.
+         * @return powers exchanged by each model
+         */
+        ModelPowersSets genPowers(
+                const IntersectionSet &intersectionSet,
+                const Powers &initialPowers,
+                unsigned threadsCount = 1
+        ) const;
+
+        /**
+         * Same as genPowers for IntersectionSet, going linearly through the compact storage.
+         * @param intersectionSet
+         * @param initialPowers
+         * @param threadsCount
+         * @return
+         */
+        ModelPowersSets genPowers(
+                const FlatIntersectionSet &intersectionSet,
+                const Powers &initialPowers,
+                unsigned threadsCount = 1
+        ) const;
 
         std::vector<const PowerExchangeModel *> models{};
     };
 
+    /**
+     * PowerExchangeController with the models fixed at compile time.
+     * The models are called through calcPowerChange, which is final in the models of this library, so the calls
+     * of all the models are resolved statically and can be inlined into a single loop over the intersections.
+     * The result is the same as that of PowerExchangeController with the same models added in the same order.
+     * Use makeStaticPowerExchangeController to construct it.
+     * @tparam Models types providing double calcPowerChange(const Intersection *previousIntersection,
+     * const Intersection &currentIntersection, double currentPower), e.g. Bremsstrahlung, Resonance,
+     * FresnelModel, XRayGain
+     */
+    template<typename... Models>
+    class StaticPowerExchangeController {
+    public:
+        /**
+         * Construct the controller referring to the models, which must outlive it
+         * @param models
+         */
+        explicit StaticPowerExchangeController(const Models &... models);
+
+        /** @return number of models */
+        std::size_t getModelsCount() const { return sizeof...(Models); }
+
+        /**
+         * Same as PowerExchangeController::genPowers
+         * @param intersectionSet
+         * @param initialPowers
+         * @param threadsCount
+         * @return powers exchanged by each model, in the order of the models given
+         */
+        ModelPowersSets genPowers(
+                const IntersectionSet &intersectionSet,
+                const Powers &initialPowers,
+                unsigned threadsCount = 1
+        ) const;
+
+        /**
+         * Same as PowerExchangeController::genPowers
+         * @param intersectionSet
+         * @param initialPowers
+         * @param threadsCount
+         * @return powers exchanged by each model, in the order of the models given
+         */
+        ModelPowersSets genPowers(
+                const FlatIntersectionSet &intersectionSet,
+                const Powers &initialPowers,
+                unsigned threadsCount = 1
+        ) const;
+
+    private:
+        std::tuple<const Models *...> models;
+        std::vector<const PowerExchangeModel *> modelsList;
+    };
+
+    /**
+     * Construct StaticPowerExchangeController deducing the model types, e.g.
+     * makeStaticPowerExchangeController(bremsstrahlung, resonance, fresnel)
+     * @param models
+     * @return the controller
+     */
+    template<typename... Models>
+    StaticPowerExchangeController<Models...> makeStaticPowerExchangeController(const Models &... models) {
+        return StaticPowerExchangeController<Models...>(models...);
+    }
+
     PowersSet modelPowersToRayPowers(const ModelPowersSets &modelPowersSets, const Powers &initialPowers);
 
+    /**
+     * Deposit the power lost by the rays between intersections into the elements crossed.
+     * The deposits are added by parallelScatterAdd, so the result is bit for bit the same for any threadsCount.
+     * @param elementsCount number of mesh elements
+     * @param powersSets ray powers given by modelPowersToRayPowers
+     * @param intersectionSet
+     * @param threadsCount number of threads, 0 means all hardware threads
+     * @return absorbed power indexed by element id
+     */
     std::vector<double> absorbRayPowers(
             std::size_t elementsCount,
             const PowersSet &powersSets,
-            const IntersectionSet &intersectionSet
+            const IntersectionSet &intersectionSet,
+            unsigned threadsCount = 1
+    );
+
+    /**
+     * Same as absorbRayPowers for IntersectionSet
+     */
+    std::vector<double> absorbRayPowers(
+            std::size_t elementsCount,
+            const PowersSet &powersSets,
+            const FlatIntersectionSet &intersectionSet,
+            unsigned threadsCount = 1
     );
 
     std::ostream &modelPowersToMsgpack(const ModelPowersSets &modelPowersSets, std::ostream &os);
 
     std::ostream &rayPowersToMsgpack(const PowersSet &powersSet, std::ostream &os);
 
+    /** Result of traceAndExchange */
+    struct ExchangeResult {
+        /** Power absorbed in each element, indexed by element id */
+        std::vector<double> absorbedPowers;
+        /** Power of each ray left after its last intersection, ordered as the rays */
+        Powers finalPowers;
+        /** Total power exchanged by each model */
+        ModelPowers modelPowers;
+        /** Power left in the rays cut off by StopAtPower, deposited in addition to modelPowers */
+        Power cutOffPower{0};
+    };
+
+    /**
+     * RayVisitor for traceRays running the models of a PowerExchangeController on every intersection as soon
+     * as it is found. The ray power is updated and the power exchanged is deposited into the element right away,
+     * so the intersections are read just once and need not be stored. The result is the same as that of genPowers,
+     * modelPowersToRayPowers and absorbRayPowers applied to the stored intersections.
+     * The visitor keeps the state of the ray being traced, so it must not be shared by threads,
+     * traceAndExchange gives each thread its own.
+     */
+    class PowerExchangeVisitor {
+    public:
+        /**
+         * Construct the visitor with zero absorbed power.
+         * @param controller whose models are run
+         * @param initialPowers powers of the rays, indexed by ray index
+         * @param elementsCount number of elements of the mesh traced
+         * @param finalPowers optional output of the ray powers left, indexed by ray index, must be large enough
+         * @param trajectory optional storage the intersections are appended to
+         * @param stopAtPower optional policy stopping rays with low power
+         * @param errLog optional log of the rays stopped by stopAtPower
+         */
+        PowerExchangeVisitor(
+                const PowerExchangeController &controller,
+                const Powers &initialPowers,
+                std::size_t elementsCount,
+                Powers *finalPowers = nullptr,
+                FlatIntersectionSet *trajectory = nullptr,
+                const StopAtPower *stopAtPower = nullptr,
+                InterErrLog *errLog = nullptr
+        );
+
+        /** Run the models on the intersection and deposit the power exchanged, see traceRays */
+        bool onIntersection(std::size_t rayIndex, const Intersection *previous, const Intersection &current);
+
+        /** Finish the ray, see traceRays */
+        void onRayEnd(std::size_t rayIndex);
+
+        /** @return power absorbed in each element so far, indexed by element id */
+        const std::vector<double> &getAbsorbedPowers() const;
+
+        /** @return power absorbed in each element so far, moved out of the visitor */
+        std::vector<double> releaseAbsorbedPowers();
+
+        /** @return total power exchanged by each model so far, ordered as the models of the controller */
+        const std::vector<double> &getModelsPowers() const;
+
+        /** @return power deposited by rays cut off by StopAtPower so far */
+        double getCutOffPower() const;
+
+    private:
+        const std::vector<const PowerExchangeModel *> &models;
+        const Powers &initialPowers;
+        Powers *finalPowers;
+        FlatIntersectionSet *trajectory;
+        const StopAtPower *stopAtPower;
+        InterErrLog *errLog;
+        std::vector<double> absorbedPowers;
+        std::vector<double> modelsPowers;
+        double cutOffPower{0};
+
+        double currentPower{0};
+        std::size_t intersectionsCount{0};
+        const Element *firstElement{};
+        double firstExchanged{0};
+    };
+
+    /**
+     * Trace the rays as findIntersections does and exchange the power on the fly using PowerExchangeVisitor.
+     * Each intersection is read once, right after it is found, and the intersections are stored only if
+     * trajectory is given. The rays are split into a fixed number of blocks of consecutive rays, which the threads
+     * take one by one. Each block deposits into its own array and the arrays are added in the order of the blocks,
+     * so the result is bit for bit the same for any threadsCount. A block finished before an earlier one keeps its
+     * array until the earlier one is added.
+     * @param mesh
+     * @param initialDirections rays incident on the mesh
+     * @param findDirection function of type DirectionFunction
+     * @param findIntersection function of type IntersectionFunction
+     * @param stopCondition function of type StopCondition
+     * @param controller whose models are run, they must be safe to call concurrently if more threads are used
+     * @param initialPowers powers of the rays, ordered as initialDirections
+     * @param stopAtPower optional policy stopping rays whose power fell low, e.g. most of it was absorbed
+     * @param trajectory optional storage of the intersections, they are appended to it ordered as the rays
+     * @param errLog optional log of rays that ended prematurely or were stopped by stopAtPower
+     * @param threadsCount number of threads, 0 means all hardware threads
+     * @return absorbed powers in elements, final ray powers and model powers
+     * @throws std::logic_error if the numbers of rays and powers differ
+     */
+    template<typename IntersectionFunction, typename StopCondition>
+    ExchangeResult traceAndExchange(const Mesh &mesh,
+                                    const std::vector<Ray> &initialDirections,
+                                    const std::vector<DirectionFunction> &findDirection,
+                                    IntersectionFunction &&findIntersection,
+                                    StopCondition &&stopCondition,
+                                    const PowerExchangeController &controller,
+                                    const Powers &initialPowers,
+                                    const StopAtPower *stopAtPower = nullptr,
+                                    FlatIntersectionSet *trajectory = nullptr,
+                                    InterErrLog *errLog = nullptr,
+                                    unsigned threadsCount = 1
+    );
+
+    /**
+     * Same as traceAndExchange, but with direction functions given as a tuple, see findIntersections.
+     */
+    template<typename IntersectionFunction, typename StopCondition, typename... DirectionFunctions>
+    ExchangeResult traceAndExchange(const Mesh &mesh,
+                                    const std::vector<Ray> &initialDirections,
+                                    std::tuple<DirectionFunctions...> findDirection,
+                                    IntersectionFunction &&findIntersection,
+                                    StopCondition &&stopCondition,
+                                    const PowerExchangeController &controller,
+                                    const Powers &initialPowers,
+                                    const StopAtPower *stopAtPower = nullptr,
+                                    FlatIntersectionSet *trajectory = nullptr,
+                                    InterErrLog *errLog = nullptr,
+                                    unsigned threadsCount = 1
+    );
+
     /**
      * Take absorption summary and make it a human readable string
      * @param summary
      * @return
      */
     std::string stringifyAbsorptionSummary(const AbsorptionSummary &summary);
+
+    //End of header, template garbage follows---------------------------------------------------------------------------
+
+    namespace impl {
+        template<std::size_t Index, std::size_t Size>
+        struct StaticExchangeStep {
+            template<typename Models>
+            static void apply(
+                    const Models &models,
+                    const Intersection *previousIntersection,
+                    const Intersection &currentIntersection,
+                    double &currentPower,
+                    double *powers,
+                    std::size_t stride
+            ) {
+                auto absorbed = std::get<Index>(models)->calcPowerChange(
+                        previousIntersection,
+                        currentIntersection,
+                        currentPower
+                );
+                currentPower -= absorbed;
+                powers[Index * stride] = absorbed;
+                StaticExchangeStep<Index + 1, Size>::apply(
+                        models, previousIntersection, currentIntersection, currentPower, powers, stride
+                );
+            }
+        };
+
+        template<std::size_t Size>
+        struct StaticExchangeStep<Size, Size> {
+            template<typename Models>
+            static void apply(const Models &, const Intersection *, const Intersection &, double &, double *,
+                              std::size_t) {}
+        };
+    }
+
+    template<typename... Models>
+    StaticPowerExchangeController<Models...>::StaticPowerExchangeController(const Models &... models) :
+            models(&models...),
+            modelsList{static_cast<const PowerExchangeModel *>(&models)...} {}
+
+    template<typename... Models>
+    ModelPowersSets StaticPowerExchangeController<Models...>::genPowers(
+            const IntersectionSet &intersectionSet,
+            const Powers &initialPowers,
+            unsigned threadsCount
+    ) const {
+        std::vector<std::size_t> rayOffsets{0};
+        rayOffsets.reserve(intersectionSet.size() + 1);
+        for (const auto &intersections : intersectionSet) {
+            rayOffsets.emplace_back(rayOffsets.back() + intersections.size());
+        }
+        ModelPowersSets result(modelsList, std::move(rayOffsets));
+        const auto intersectionsCount = result.getIntersectionsCount();
+        double *powers = result.getPowers(0);
+
+        parallelFor(intersectionSet.size(), threadsCount, [&](std::size_t setIndex) {
+            const auto &intersections = intersectionSet[setIndex];
+            auto begin = result.getRayBegin(setIndex);
+            auto currentPower = initialPowers[setIndex].asDouble;
+            for (std::size_t i = 0; i < intersections.size(); i++) {
+                impl::StaticExchangeStep<0, sizeof...(Models)>::apply(
+                        models,
+                        i > 0 ? &intersections[i - 1] : nullptr,
+                        intersections[i],
+                        currentPower,
+                        powers + begin + i,
+                        intersectionsCount
+                );
+            }
+        });
+        return result;
+    }
+
+    template<typename... Models>
+    ModelPowersSets StaticPowerExchangeController<Models...>::genPowers(
+            const FlatIntersectionSet &intersectionSet,
+            const Powers &initialPowers,
+            unsigned threadsCount
+    ) const {
+        std::vector<std::size_t> rayOffsets;
+        rayOffsets.reserve(intersectionSet.getRaysCount() + 1);
+        for (std::size_t setIndex = 0; setIndex < intersectionSet.getRaysCount(); setIndex++) {
+            rayOffsets.emplace_back(intersectionSet.getRayBegin(setIndex));
+        }
+        rayOffsets.emplace_back(intersectionSet.getIntersectionsCount());
+        ModelPowersSets result(modelsList, std::move(rayOffsets));
+        const auto intersectionsCount = result.getIntersectionsCount();
+        double *powers = result.getPowers(0);
+
+        parallelFor(intersectionSet.getRaysCount(), threadsCount, [&](std::size_t setIndex) {
+            auto begin = intersectionSet.getRayBegin(setIndex);
+            auto end = intersectionSet.getRayEnd(setIndex);
+            auto currentPower = initialPowers[setIndex].asDouble;
+            // The current and previous intersections take turns in the two slots, so the previous one is not copied
+            Intersection intersections[2];
+            for (std::size_t index = begin; index < end; index++) {
+                auto &intersection = intersections[(index - begin) % 2];
+                intersection = intersectionSet.getIntersection(setIndex, index);
+                impl::StaticExchangeStep<0, sizeof...(Models)>::apply(
+                        models,
+                        index > begin ? &intersections[(index - begin + 1) % 2] : nullptr,
+                        intersection,
+                        currentPower,
+                        powers + index,
+                        intersectionsCount
+                );
+            }
+        });
+        return result;
+    }
+
+    namespace impl {
+        /**
+         * Number of blocks of consecutive rays traceAndExchange hands out to the threads. It is fixed, so that
+         * the per block sums are added in the same order for any number of threads.
+         */
+        constexpr std::size_t exchangeBlocksCount = 64;
+
+        template<typename DirectionFunc, typename IntersectionFunction, typename StopCondition>
+        ExchangeResult traceAndExchange(
+                const Mesh &mesh,
+                const std::vector<Ray> &initialDirections,
+                DirectionFunc &&findDirection,
+                IntersectionFunction &&findIntersection,
+                StopCondition &&stopCondition,
+                const PowerExchangeController &controller,
+                const Powers &initialPowers,
+                const StopAtPower *stopAtPower,
+                FlatIntersectionSet *trajectory,
+                InterErrLog *errLog,
+                unsigned threadsCount
+        ) {
+            if (initialPowers.size() != initialDirections.size()) {
+                throw std::logic_error("Each ray must have its initial power!");
+            }
+            ExchangeResult result;
+            result.finalPowers.resize(initialDirections.size());
+            auto elementsCount = mesh.getElements().size();
+
+            const auto raysCount = initialDirections.size();
+            const auto blocksCount = std::min(exchangeBlocksCount, raysCount);
+            auto blockBegin = [raysCount, blocksCount](std::size_t blockIndex) {
+                return raysCount * blockIndex / blocksCount;
+            };
+            std::vector<FlatIntersectionSet> trajectories(trajectory ? blocksCount : 0, FlatIntersectionSet(mesh));
+            result.absorbedPowers.assign(elementsCount, 0);
+            std::vector<double> modelsPowers(controller.getModelsCount(), 0);
+
+            // A finished block waits here until all blocks before it are added, so the sums are always
+            // made in the order of the blocks, whichever thread traced them
+            std::vector<std::unique_ptr<PowerExchangeVisitor>> finishedBlocks(blocksCount);
+            std::size_t addedBlocksCount = 0;
+            std::mutex addMutex;
+            parallelFor(blocksCount, threadsCount, [&](std::size_t blockIndex) {
+                auto visitor = make_unique<PowerExchangeVisitor>(
+                        controller,
+                        initialPowers,
+                        elementsCount,
+                        &result.finalPowers,
+                        trajectory ? &trajectories[blockIndex] : nullptr,
+                        stopAtPower,
+                        errLog
+                );
+                for (auto rayIndex = blockBegin(blockIndex); rayIndex < blockBegin(blockIndex + 1); ++rayIndex) {
+                    impl::traceRay(
+                            mesh,
+                            initialDirections[rayIndex],
+                            rayIndex,
+                            findDirection,
+                            findIntersection,
+                            stopCondition,
+                            *visitor,
+                            errLog
+                    );
+                }
+
+                std::lock_guard<std::mutex> lock(addMutex);
+                finishedBlocks[blockIndex] = std::move(visitor);
+                for (; addedBlocksCount < blocksCount && finishedBlocks[addedBlocksCount]; ++addedBlocksCount) {
+                    const auto &block = *finishedBlocks[addedBlocksCount];
+                    const auto &absorbedPowers = block.getAbsorbedPowers();
+                    for (std::size_t i = 0; i < elementsCount; ++i) result.absorbedPowers[i] += absorbedPowers[i];
+                    const auto &blockModelsPowers = block.getModelsPowers();
+                    for (std::size_t i = 0; i < modelsPowers.size(); ++i) modelsPowers[i] += blockModelsPowers[i];
+                    result.cutOffPower.asDouble += block.getCutOffPower();
+                    finishedBlocks[addedBlocksCount].reset();
+                }
+            });
+
+            for (std::size_t i = 0; i < modelsPowers.size(); ++i) {
+                result.modelPowers[controller.models[i]].asDouble += modelsPowers[i];
+            }
+            if (trajectory) trajectory->append(std::move(trajectories), threadsCount);
+            return result;
+        }
+    }
+
+    template<typename IntersectionFunction, typename StopCondition>
+    ExchangeResult traceAndExchange(
+            const Mesh &mesh,
+            const std::vector<Ray> &initialDirections,
+            const std::vector<DirectionFunction> &findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            const PowerExchangeController &controller,
+            const Powers &initialPowers,
+            const StopAtPower *stopAtPower,
+            FlatIntersectionSet *trajectory,
+            InterErrLog *errLog,
+            unsigned threadsCount
+    ) {
+        return impl::traceAndExchange(
+                mesh,
+                initialDirections,
+                impl::DirectionFunctions{findDirection},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                controller,
+                initialPowers,
+                stopAtPower,
+                trajectory,
+                errLog,
+                threadsCount
+        );
+    }
+
+    template<typename IntersectionFunction, typename StopCondition, typename... DirectionFunctions>
+    ExchangeResult traceAndExchange(
+            const Mesh &mesh,
+            const std::vector<Ray> &initialDirections,
+            std::tuple<DirectionFunctions...> findDirection,
+            IntersectionFunction &&findIntersection,
+            StopCondition &&stopCondition,
+            const PowerExchangeController &controller,
+            const Powers &initialPowers,
+            const StopAtPower *stopAtPower,
+            FlatIntersectionSet *trajectory,
+            InterErrLog *errLog,
+            unsigned threadsCount
+    ) {
+        return impl::traceAndExchange(
+                mesh,
+                initialDirections,
+                impl::DirectionChain<DirectionFunctions...>{std::move(findDirection)},
+                std::forward<IntersectionFunction>(findIntersection),
+                std::forward<StopCondition>(stopCondition),
+                controller,
+                initialPowers,
+                stopAtPower,
+                trajectory,
+                errLog,
+                threadsCount
+        );
+    }
 }
 
 #endif //RAYTRACER_ABSORPTION_H
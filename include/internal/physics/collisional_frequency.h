@@ -4,11 +4,32 @@
 #include "magnitudes.h"
 #include <cmath>
 #include <algorithm>
+#include <vector>
 #include <geometry.h>
+#include <array_view.h>
 
 namespace raytracer {
     double calcSpitzerFreq(double dens, double temp, double ioni, Length wavelen);
 
+    /**
+     * Calculate calcSpitzerFreq for whole arrays at once, e.g. for all elements of a mesh.
+     * The constants are evaluated once and the loop is plain real arithmetic the compiler can vectorize.
+     * @param dens electron densities
+     * @param temp electron temperatures
+     * @param ioni ionizations
+     * @param wavelen
+     * @param threadsCount number of threads to split the arrays among, 0 means all hardware threads
+     * @return collisional frequencies in the order of the arrays given
+     * @throws std::logic_error if the arrays have different sizes or any frequency is nan
+     */
+    std::vector<double> calcSpitzerFreqs(
+            ArrayView<double> dens,
+            ArrayView<double> temp,
+            ArrayView<double> ioni,
+            Length wavelen,
+            unsigned threadsCount = 1
+    );
+
     namespace impl {
         double calcCoulombLog(double dens, double temp, double ioni, Length wavelen);
     }
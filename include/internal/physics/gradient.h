@@ -1,22 +1,25 @@
 #ifndef RAYTRACER_GRADIENT_H
 #define RAYTRACER_GRADIENT_H
 
+#include <array>
+#include <memory>
 #include <utility>
 
 #include "mfem.hpp"
 #include <geometry.h>
 #include <qr_decomposition.h>
+#include "least_squares.h"
 
 namespace raytracer {
     /**
      * Vectors at points
      */
-    using VectorField = std::map<Point *, Vector>;
+    using VectorField = NodalField<Vector>;
 
     /**
      * Scalars at points
      */
-    using ScalarField = std::map<Point *, double>;
+    using ScalarField = NodalField<double>;
 
     class Gradient {
     public:
@@ -60,7 +63,89 @@ namespace raytracer {
     }
 
     /**
-     * Take L2 GridFunction and project it on new H1 GridFunction
+     * Gradient of L2 GridFunctions projected on H1 solving a linear system by preconditioned conjugate gradients.
+     * The forms and the eliminated system matrix are assembled once and reused for every solve, as long as
+     * the mesh and the diffusion coefficient stay the same. Each solve starts from the previous solution
+     * and stops at the same residual mfem::PCG reaches starting from zero, so a slowly changing function
+     * needs few iterations.
+     * Call update() after the mesh nodes moved.
+     */
+    class MfemGradientSolver {
+    public:
+        /**
+         * Preconditioner of the conjugate gradients
+         */
+        enum class Preconditioner {
+            Jacobi, ///< diagonal scaling, the cheapest one
+            GaussSeidel ///< symmetric Gauss-Seidel, usually needs several times less iterations
+        };
+
+        /**
+         * Assemble the system
+         * @param mesh
+         * @param l2Space space of the functions whose gradient will be calculated
+         * @param vectorBoundaryValue gradient prescribed at the boundary, zero if nullptr, must outlive the solver
+         * @param diffusionC smoothing diffusion coefficient, no smoothing if 0
+         * @param meshH characteristic mesh size the diffusion is scaled with
+         * @param preconditioner
+         */
+        MfemGradientSolver(
+                const MfemMesh &mesh,
+                mfem::FiniteElementSpace *l2Space,
+                mfem::VectorCoefficient *vectorBoundaryValue = nullptr,
+                double diffusionC = 0,
+                double meshH = 0,
+                Preconditioner preconditioner = Preconditioner::GaussSeidel
+        );
+
+        /**
+         * Assemble the system again, needed after the mesh nodes moved
+         */
+        void update();
+
+        /**
+         * Calculate the gradient
+         * @param rho function from the l2Space given at construction
+         * @return gradient at inner points
+         */
+        template<typename MeshFunc>
+        VectorField solve(MeshFunc &rho) {
+            return this->solve(*rho.getGF());
+        }
+
+        /**
+         * Calculate the gradient
+         * @param rho GridFunction from the l2Space given at construction
+         * @return gradient at inner points
+         */
+        VectorField solve(const mfem::GridFunction &rho);
+
+        /** @return number of iterations the last solve took */
+        int getLastIterationsCount() const;
+
+    private:
+        const MfemMesh &mesh;
+        mfem::VectorCoefficient *vectorBoundaryValue;
+        mfem::H1_FECollection h1Fec;
+        mfem::FiniteElementSpace h1Space;
+        mfem::Array<int> bdrMarker;
+        mfem::Array<int> essTrueDofs;
+        mfem::ConstantCoefficient divergenceCoefficient{-1};
+        mfem::ConstantCoefficient diffusionCoefficient;
+        mfem::MixedBilinearForm rightSide;
+        mfem::BilinearForm leftSide;
+        mfem::LinearForm rightSideVector;
+        mfem::GridFunction solution;
+        mfem::SparseMatrix A;
+        mfem::Vector X, B, preconditionedB;
+        std::unique_ptr<mfem::Solver> preconditioner;
+        mfem::CGSolver solver;
+        bool isOperatorSet{false};
+    };
+
+    /**
+     * Take L2 GridFunction and project it on new H1 GridFunction.
+     * This assembles everything from scratch, use MfemGradientSolver if the gradient is needed repeatedly.
      * @param rho
      * @param l2Space
      * @param h1Space
@@ -74,39 +159,15 @@ namespace raytracer {
             double diffusionC = 0,
             double meshH = 0
                     ){
-        auto dim = mesh.getMfemMesh()->Dimension();
-        mfem::H1_FECollection h1Fec{1, dim};
-        mfem::FiniteElementSpace h1Space(mesh.getMfemMesh(), &h1Fec, dim);
-
-        auto bdrMarker = impl::allBdrMarker(*mesh.getMfemMesh());
-
-        mfem::GridFunction initialValue(&h1Space);
-        initialValue = 0;
-        if (vectorBoundaryValue) {
-            initialValue.ProjectBdrCoefficient(*vectorBoundaryValue, bdrMarker);
-        }
-
-        mfem::MixedBilinearForm rightSide(&h1Space, rho.getGF()->FESpace());
-        mfem::ConstantCoefficient coefficient(-1);
-        rightSide.AddDomainIntegrator(new mfem::VectorDivergenceIntegrator(coefficient));
-        rightSide.Assemble();
-        rightSide.Finalize();
-        mfem::LinearForm rightSideVector(&h1Space);
-        rightSide.MultTranspose(*rho.getGF(), rightSideVector);
-
-        mfem::BilinearForm leftSideMatrix(&h1Space);
-        leftSideMatrix.AddDomainIntegrator(new mfem::VectorMassIntegrator);
-        mfem::ConstantCoefficient diffCoeff(diffusionC*meshH*meshH);
-        if (diffusionC != 0) {
-            leftSideMatrix.AddDomainIntegrator(new mfem::VectorDiffusionIntegrator(diffCoeff));
-        }
-        leftSideMatrix.Assemble();
-        leftSideMatrix.Finalize();
-
-        auto essTrueDofs = impl::getEssTrueDofs(bdrMarker, h1Space);
-        auto solution = impl::solveByPCG(leftSideMatrix, rightSideVector, essTrueDofs, initialValue);
-
-        return impl::gfToField(mesh, solution);
+        MfemGradientSolver solver(
+                mesh,
+                rho.getGF()->FESpace(),
+                vectorBoundaryValue,
+                diffusionC,
+                meshH,
+                MfemGradientSolver::Preconditioner::Jacobi
+        );
+        return solver.solve(rho);
     }
 
 
@@ -142,46 +203,103 @@ namespace raytracer {
 
     };
 
+    /**
+     * Gradient linearly interpolated along faces from the gradient at nodes, same as LinInterGrad.
+     * The gradients at both points of every face and the inverse face length are stored contiguously
+     * by face id, so evaluating the gradient is a single lookup and a multiply-add.
+     * Each thread also remembers the last evaluated crossing, so the direction functions and models
+     * asking for the gradient at the same PointOnFace interpolate it only once.
+     */
+    class FaceInterGrad : public Gradient {
+    public:
+        /**
+         * Precompute the interpolation for all faces of the mesh
+         * @param mesh
+         * @param gradientAtPoints faces with a point without gradient have no gradient
+         */
+        FaceInterGrad(const Mesh &mesh, const VectorField &gradientAtPoints);
+
+        /**
+         * Calculate the gradient in a point on a face by linear interpolation of gradient at nodes
+         * @param pointOnFace
+         * @return the gradient or nothing if it is not known at a point of the face
+         */
+        tl::optional<Vector> get(const PointOnFace &pointOnFace) const override;
+
+    private:
+        struct FaceData {
+            double startX{}, startY{};
+            double invLength{};
+            Vector startGradient{};
+            Vector gradientChange{};
+            bool isValid{false};
+        };
+
+        std::vector<FaceData> faces;
+        int id;
+    };
+
     namespace impl {
         Vector solveOverdetermined(rosetta::Matrix &A, rosetta::Matrix &b);
 
+        /**
+         * Elements used to fit the gradient at point by least squares. If the point has less than three
+         * adjacent elements, the neighbours of the first one are added and nullptr, which stands for
+         * the first element mirrored over the point with zero value.
+         * @param mesh
+         * @param point
+         * @param buffer storage used if the adjacent elements have to be extended
+         * @return the elements
+         */
+        ArrayView<Element *> getHousStencil(const Mesh &mesh, const Point *point, std::vector<Element *> &buffer);
+
+        /**
+         * Calculate the row of the least squares system for one element of the stencil
+         * @param point at which the gradient is fitted
+         * @param element of the stencil, nullptr stands for the mirrored firstElement
+         * @param firstElement first element of the stencil
+         * @param row the weighted coefficients of the row
+         * @return weight of the row
+         */
+        double getHousRow(
+                const Point *point,
+                const Element *element,
+                const Element &firstElement,
+                std::array<double, 3> &row
+        );
+
+        /**
+         * Stencils up to this size are solved on the stack, larger ones fall back to rosetta
+         */
+        constexpr int housMaxStackRows = 16;
+
         template <typename MeshFunc>
         Vector getGradientAtPoint(const Mesh &mesh, const MeshFunc &meshFunction, const Point *point) {
-            int index = 0;
-            auto elements = mesh.getPointAdjacentElements(point);
-            if (elements.size() < 3) {
-                elements = {elements[0]};
-                auto adjacent = mesh.getElementAdjacentElements(*elements[0]);
-                elements.insert(elements.end(), adjacent.begin(), adjacent.end());
-                elements.emplace_back(nullptr);
+            std::vector<Element *> buffer;
+            auto elements = getHousStencil(mesh, point, buffer);
+            std::array<double, 3> row{};
+
+            if (elements.size() > static_cast<std::size_t>(housMaxStackRows)) {
+                rosetta::Matrix A(elements.size(), 3);
+                rosetta::Matrix b(elements.size(), 1);
+                int index = 0;
+                for (const auto &element : elements) {
+                    double value = element ? meshFunction[element->getId()] : 0;
+                    b(index, 0) = getHousRow(point, element, *elements[0], row) * value;
+                    for (int i = 0; i < 3; ++i) A(index, i) = row[i];
+                    ++index;
+                }
+                return solveOverdetermined(A, b);
             }
 
-            rosetta::Matrix A(elements.size(), 3);
-            rosetta::Matrix b(elements.size(), 1);
+            SmallLeastSquares<housMaxStackRows> system;
             for (const auto &element : elements) {
-                Point centroid;
-                double value;
-                if (!element) {
-                    auto elementCentroid = getElementCentroid(*elements[0]);
-                    centroid = Point(Vector(*point) + (*point - elementCentroid));
-                    value = 0;
-                } else {
-                    centroid = getElementCentroid(*element);
-                    value = meshFunction[element->getId()];
-                }
-
-                auto dx = centroid.x - point->x;
-                auto dy = centroid.y - point->y;
-                auto d = dx * dx + dy * dy;
-                auto weight = 1 / std::pow(d, 0.125);
-                A(index, 0) = weight;
-                A(index, 1) = weight * dx;
-                A(index, 2) = weight * dy;
-                b(index, 0) = weight * value;
-                ++index;
+                double value = element ? meshFunction[element->getId()] : 0;
+                double weight = getHousRow(point, element, *elements[0], row);
+                system.addRow(row[0], row[1], row[2], weight * value);
             }
-            auto result = solveOverdetermined(A, b);
-            return result;
+            auto result = system.solve();
+            return {result[1], result[2]};
         }
     }
 
@@ -189,44 +307,35 @@ namespace raytracer {
      * Calculate the gradient at nodes via LS solved by householder factorization
      * @param mesh
      * @param meshFunction to be used to calculate gradient
+     * @param includeBorder if false the gradient is calculated at inner points only
+     * @param threadsCount number of threads to spread the points over, 0 means all hardware threads,
+     * the result does not depend on it
      * @return gradients at points
      */
     template<typename MeshFunc>
-    VectorField calcHousGrad(const Mesh &mesh, const MeshFunc &meshFunction, bool includeBorder = true) {
-        VectorField result;
-        if (includeBorder) {
-            for (const auto &point : mesh.getPoints()) {
-                result.insert({point, impl::getGradientAtPoint(mesh, meshFunction, point)});
-            }
-        } else {
-            for (const auto &point : mesh.getInnerPoints()) {
-                result.insert({point, impl::getGradientAtPoint(mesh, meshFunction, point)});
-            }
-        }
+    VectorField calcHousGrad(
+            const Mesh &mesh,
+            const MeshFunc &meshFunction,
+            bool includeBorder = true,
+            unsigned threadsCount = 1
+    ) {
+        // The field is sized up front so that concurrent writes to distinct points never reallocate it
+        VectorField result(mesh.getPoints().size());
+        auto points = includeBorder ? mesh.getPoints() : mesh.getInnerPoints();
+        parallelFor(points.size(), threadsCount, [&](std::size_t i) {
+            result[points[i]] = impl::getGradientAtPoint(mesh, meshFunction, points[i]);
+        });
         return result;
     }
 
-    VectorField setValue(const VectorField &grad, const std::vector<Point *> &points, const Vector &value);
+    VectorField setValue(const VectorField &grad, ArrayView<Point *> points, const Vector &value);
 
     namespace impl{
         bool isQuadMesh(const Mesh &mesh);
         double calcTriangleArea(const Point &a, const Point &b, const Point &c);
-    }
-    /**
-     * Calculate the gradient in inner points of the mesh using integral over a curve.
-     * This is a classic version assuming curve connecting centers of adjacent points.
-     * It is only available for quadrilateral meshes
-     * @param mesh
-     * @param meshFunction which gradient is to be calculated
-     * @return gradients at points
-     */
-    template <typename MeshFunc>
-    VectorField calcIntegralGrad(const Mesh &mesh, const MeshFunc &meshFunction){
-        VectorField result;
 
-        if (!impl::isQuadMesh(mesh)) throw std::logic_error("Integral grad is only available for quads");
-
-        for (Point *point : mesh.getInnerPoints()) {
+        template <typename MeshFunc>
+        Vector getIntegralGradientAtPoint(const Mesh &mesh, const MeshFunc &meshFunction, const Point *point) {
             const auto &elements = mesh.getPointAdjOrderedElements(point);
             const auto &points = mesh.getPointAdjOrderedPoints(point);
 
@@ -248,8 +357,29 @@ namespace raytracer {
             }
             gradX /= volume;
             gradY /= volume;
-            result[point] = Vector{gradX, gradY};
+            return Vector{gradX, gradY};
         }
+    }
+
+    /**
+     * Calculate the gradient in inner points of the mesh using integral over a curve.
+     * This is a classic version assuming curve connecting centers of adjacent points.
+     * It is only available for quadrilateral meshes
+     * @param mesh
+     * @param meshFunction which gradient is to be calculated
+     * @param threadsCount number of threads to spread the points over, 0 means all hardware threads,
+     * the result does not depend on it
+     * @return gradients at points
+     */
+    template <typename MeshFunc>
+    VectorField calcIntegralGrad(const Mesh &mesh, const MeshFunc &meshFunction, unsigned threadsCount = 1){
+        if (!impl::isQuadMesh(mesh)) throw std::logic_error("Integral grad is only available for quads");
+
+        VectorField result(mesh.getPoints().size());
+        auto points = mesh.getInnerPoints();
+        parallelFor(points.size(), threadsCount, [&](std::size_t i) {
+            result[points[i]] = impl::getIntegralGradientAtPoint(mesh, meshFunction, points[i]);
+        });
         return result;
     }
 
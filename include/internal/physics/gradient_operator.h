@@ -0,0 +1,94 @@
+#ifndef RAYTRACER_GRADIENT_OPERATOR_H
+#define RAYTRACER_GRADIENT_OPERATOR_H
+
+#include <cstdint>
+#include <vector>
+#include <geometry.h>
+#include <utility.h>
+#include "gradient.h"
+
+namespace raytracer {
+
+    /**
+     * Gradient at points as a linear operator acting on values at elements.
+     * The operator is a sparse matrix stored in compressed sparse rows, one row per point with
+     * the ids of the stencil elements and the x and y weights of their values. The weights depend
+     * on the mesh geometry only, so a gradient method can be assembled once per mesh and then
+     * applied to every new mesh function, which is a single sparse matrix vector product.
+     * Assemble it again if the mesh nodes moved.
+     */
+    class GradientOperator {
+    public:
+        /**
+         * Start a new row, entries added afterwards belong to it
+         * @param point at which the row gives the gradient
+         */
+        void addRow(Point *point);
+
+        /**
+         * Add an entry to the last row
+         * @param elementId id of the element whose value is weighted
+         * @param weight the x and y weights
+         */
+        void addEntry(int elementId, const Vector &weight);
+
+        /** @return number of rows, i.e. points at which the gradient is given */
+        std::size_t getRowsCount() const { return rowPoints.size(); }
+
+        /** @return number of nonzero entries */
+        std::size_t getEntriesCount() const { return columns.size(); }
+
+        /**
+         * Calculate the gradient of the meshFunction
+         * @param meshFunction values at elements, indexed by element id
+         * @param threadsCount number of threads to spread the rows over, 0 means all hardware threads
+         * @return gradients at the points of the rows
+         */
+        template<typename MeshFunc>
+        VectorField apply(const MeshFunc &meshFunction, unsigned threadsCount = 1) const;
+
+    private:
+        std::vector<Point *> rowPoints;
+        std::vector<std::size_t> rowOffsets{0};
+        std::vector<std::int32_t> columns;
+        std::vector<double> weightsX;
+        std::vector<double> weightsY;
+        std::size_t slotsCount{0};
+    };
+
+    /**
+     * Assemble the operator equivalent to calcHousGrad, i.e. weighted least squares solved by householder
+     * factorization.
+     * @param mesh
+     * @param includeBorder if false only inner points get a row
+     * @return the operator
+     */
+    GradientOperator assembleHousGradOperator(const Mesh &mesh, bool includeBorder = true);
+
+    /**
+     * Assemble the operator equivalent to calcIntegralGrad, available for quadrilateral meshes only.
+     * @param mesh
+     * @return the operator
+     */
+    GradientOperator assembleIntegralGradOperator(const Mesh &mesh);
+
+    //End of header, template garbage follows
+
+    template<typename MeshFunc>
+    VectorField GradientOperator::apply(const MeshFunc &meshFunction, unsigned threadsCount) const {
+        VectorField result(slotsCount);
+        parallelFor(rowPoints.size(), threadsCount, [&](std::size_t row) {
+            double gradX = 0;
+            double gradY = 0;
+            for (auto entry = rowOffsets[row]; entry < rowOffsets[row + 1]; ++entry) {
+                double value = meshFunction[columns[entry]];
+                gradX += weightsX[entry] * value;
+                gradY += weightsY[entry] * value;
+            }
+            result[rowPoints[row]] = Vector{gradX, gradY};
+        });
+        return result;
+    }
+}
+
+#endif //RAYTRACER_GRADIENT_OPERATOR_H
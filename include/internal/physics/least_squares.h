@@ -0,0 +1,101 @@
+#ifndef RAYTRACER_LEAST_SQUARES_H
+#define RAYTRACER_LEAST_SQUARES_H
+
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+namespace raytracer {
+
+    /**
+     * Least squares solution of an overdetermined system with three unknowns and at most MaxRows equations.
+     * The system lives in fixed size arrays, so it can be kept on the stack and solving it never allocates.
+     * It is solved by householder QR factorization applied in place to the rows and the right hand side,
+     * Q is never formed.
+     * @tparam MaxRows maximal number of equations
+     */
+    template<int MaxRows>
+    class SmallLeastSquares {
+    public:
+        /** Maximal number of equations */
+        static constexpr int maxRowsCount = MaxRows;
+
+        /**
+         * Add the equation a0 * x0 + a1 * x1 + a2 * x2 = b
+         * @throws std::logic_error if the system already has MaxRows equations
+         */
+        void addRow(double a0, double a1, double a2, double b);
+
+        /** @return number of equations added so far */
+        int getRowsCount() const { return rowsCount; }
+
+        /**
+         * Solve the system in the least squares sense. The factorization is done in place,
+         * so the system can not be used for anything else afterwards.
+         * @return the unknowns x0, x1, x2
+         * @throws std::logic_error if there are less than three equations or the system is singular
+         */
+        std::array<double, 3> solve();
+
+    private:
+        double A[MaxRows][3];
+        double b[MaxRows];
+        int rowsCount{0};
+    };
+
+    //End of header, template garbage follows
+
+    template<int MaxRows>
+    constexpr int SmallLeastSquares<MaxRows>::maxRowsCount;
+
+    template<int MaxRows>
+    void SmallLeastSquares<MaxRows>::addRow(double a0, double a1, double a2, double value) {
+        if (rowsCount == MaxRows) throw std::logic_error("Too many equations for the least squares system!");
+        A[rowsCount][0] = a0;
+        A[rowsCount][1] = a1;
+        A[rowsCount][2] = a2;
+        b[rowsCount] = value;
+        ++rowsCount;
+    }
+
+    template<int MaxRows>
+    std::array<double, 3> SmallLeastSquares<MaxRows>::solve() {
+        if (rowsCount < 3) throw std::logic_error("Least squares system needs at least three equations!");
+
+        double v[MaxRows];
+        for (int k = 0; k < 3; ++k) {
+            double norm2 = 0;
+            for (int i = k; i < rowsCount; ++i) norm2 += A[i][k] * A[i][k];
+            if (norm2 == 0) throw std::logic_error("Least squares system is singular!");
+            // Reflect the column onto -sign(A[k][k]) * e_k to avoid cancellation
+            double alpha = A[k][k] > 0 ? -std::sqrt(norm2) : std::sqrt(norm2);
+            for (int i = k; i < rowsCount; ++i) v[i] = A[i][k];
+            v[k] -= alpha;
+            double vNorm2 = norm2 - A[k][k] * A[k][k] + v[k] * v[k];
+
+            A[k][k] = alpha;
+            for (int i = k + 1; i < rowsCount; ++i) A[i][k] = 0;
+            if (vNorm2 == 0) continue;
+            for (int j = k + 1; j < 3; ++j) {
+                double dot = 0;
+                for (int i = k; i < rowsCount; ++i) dot += v[i] * A[i][j];
+                double factor = 2 * dot / vNorm2;
+                for (int i = k; i < rowsCount; ++i) A[i][j] -= factor * v[i];
+            }
+            double dot = 0;
+            for (int i = k; i < rowsCount; ++i) dot += v[i] * b[i];
+            double factor = 2 * dot / vNorm2;
+            for (int i = k; i < rowsCount; ++i) b[i] -= factor * v[i];
+        }
+
+        std::array<double, 3> x{};
+        for (int k = 2; k >= 0; --k) {
+            double result = b[k];
+            for (int i = k + 1; i < 3; ++i) result -= A[k][i] * x[i];
+            x[k] = result / A[k][k];
+        }
+        return x;
+    }
+}
+
+#endif //RAYTRACER_LEAST_SQUARES_H
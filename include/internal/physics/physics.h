@@ -5,7 +5,9 @@
 #include "collisional_frequency.h"
 #include "constants.h"
 #include "gradient.h"
+#include "gradient_operator.h"
 #include "laser.h"
+#include "least_squares.h"
 #include "magnitudes.h"
 #include "physics.h"
 #include "propagation.h"
@@ -16,6 +16,7 @@ namespace raytracer {
             const Vector &entryDirection,
             const Element &element
     );
+
 }
 
 
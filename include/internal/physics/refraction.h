@@ -8,7 +8,11 @@
 #include <complex>
 #include <utility>
 #include <utility.h>
-#include <set>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <algorithm>
 
 
 namespace raytracer {
@@ -30,16 +34,65 @@ namespace raytracer {
 
     double calcInvBremssCoeff(double density, const Length &wavelength, double collFreq);
 
+    /**
+     * Calculate calcRefractIndex for whole arrays at once, e.g. for all elements of a mesh.
+     * The complex square root of the permittivity is evaluated in real arithmetic the compiler can vectorize.
+     * @param density
+     * @param wavelength
+     * @param collFreq collisional frequencies, same size as density
+     * @param threadsCount number of threads to split the arrays among, 0 means all hardware threads
+     * @return refractive indices in the order of the arrays given
+     * @throws std::logic_error if the arrays have different sizes or any index is nan
+     */
+    std::vector<double> calcRefractIndices(
+            ArrayView<double> density,
+            const Length &wavelength,
+            ArrayView<double> collFreq,
+            unsigned threadsCount = 1
+    );
+
+    /**
+     * Calculate calcInvBremssCoeff for whole arrays at once, see calcRefractIndices
+     * @param density
+     * @param wavelength
+     * @param collFreq collisional frequencies, same size as density
+     * @param threadsCount number of threads to split the arrays among, 0 means all hardware threads
+     * @return inverse bremsstrahlung coefficients in the order of the arrays given
+     * @throws std::logic_error if the arrays have different sizes
+     */
+    std::vector<double> calcInvBremssCoeffs(
+            ArrayView<double> density,
+            const Length &wavelength,
+            ArrayView<double> collFreq,
+            unsigned threadsCount = 1
+    );
+
 
     namespace impl {
         std::complex<double> calcPermittivity(double density, const Length &wavelength, double collFreq);
     }
 
     /**
-     * Class used to mark elements that have some property. Actually it is just a set internally.
+     * Class used to mark crossings that have some property. The marks are kept in a bitset per ray
+     * indexed by the crossing index, see getCrossingId. Bitsets of rays are allocated lazily in chunks
+     * published atomically, so a Marker can be shared by threads tracing in parallel without locking
+     * as long as every ray is traced by a single thread, which is how findIntersections works.
+     * The chunks are kept in segments of doubling size, so any number of rays can be marked.
+     *
+     * Crossing ids start from zero in every tracing call, so one Marker serves one trace.
+     * Use a new Marker for every findIntersections call (e.g. every timestep), marks of an earlier
+     * trace would otherwise apply to the crossings of the later one.
      */
     class Marker {
     public:
+        Marker();
+
+        ~Marker();
+
+        Marker(const Marker &) = delete;
+
+        Marker &operator=(const Marker &) = delete;
+
         /**
          * Mark a PointOnFace
          * @param pointOnFace
@@ -60,9 +113,96 @@ namespace raytracer {
         bool isMarked(const PointOnFace &pointOnFace) const;
 
     private:
-        std::set<int> marked;
+        static constexpr std::size_t raysPerChunk = 256;
+        /** Segment k holds 2^k chunks */
+        static constexpr std::size_t segmentsCount = 64;
+
+        struct Chunk {
+            std::vector<std::uint64_t> rays[raysPerChunk];
+        };
+
+        using Segment = std::atomic<Chunk *>;
+
+        static std::size_t getSegmentIndex(std::size_t chunkIndex);
+
+        std::vector<std::uint64_t> *findRay(std::size_t rayIndex) const;
+
+        std::vector<std::uint64_t> &getRay(std::size_t rayIndex);
+
+        std::atomic<Segment *> segments[segmentsCount];
     };
 
+    /**
+     * Everything the refraction functors need to know about a single crossing of a face.
+     * It is calculated once per crossing and shared by all the functions of a RefractionChain,
+     * so that the adjacent elements, the gradient and the refractive indices are looked up only once.
+     */
+    struct CrossingContext {
+        /** The crossing */
+        const PointOnFace *pointOnFace{};
+        /** Direction the ray came from */
+        Vector direction{};
+        /** The direction normalized */
+        Vector unitDirection{};
+        /** Element the ray comes from, nullptr if it enters the mesh */
+        const Element *previousElement{};
+        /** Element the ray continues to, nullptr if it leaves the mesh, the rest is not set then */
+        const Element *nextElement{};
+        /** Gradient at the crossing or the fallback one, nothing if neither is known or it is zero */
+        tl::optional<Vector> gradient{};
+        /** The gradient normalized, set only if there is a gradient */
+        Vector unitGradient{};
+        /** Refractive index of previousElement, min(n2, 1) outside of the mesh */
+        double n1{};
+        /** Refractive index of nextElement */
+        double n2{};
+    };
+
+    /**
+     * Calculate the crossing context
+     * @param mesh
+     * @param refractIndex
+     * @param gradCalc
+     * @param fallbackGrad used if the gradient is not known or zero, may be nullptr
+     * @param pointOnFace
+     * @param direction the ray came from
+     * @return the context
+     */
+    template<typename MeshFunc>
+    CrossingContext makeCrossingContext(
+            const Mesh &mesh,
+            const MeshFunc &refractIndex,
+            const Gradient &gradCalc,
+            const Vector *fallbackGrad,
+            const PointOnFace &pointOnFace,
+            const Vector &direction
+    ) {
+        CrossingContext context;
+        context.pointOnFace = &pointOnFace;
+        context.direction = direction;
+        context.nextElement = mesh.getFaceDirAdjElement(pointOnFace.face, direction);
+        if (!context.nextElement) return context;
+        context.previousElement = mesh.getFaceDirAdjElement(pointOnFace.face, -1 * direction);
+        context.unitDirection = 1 / direction.getNorm() * direction;
+
+        context.gradient = gradCalc.get(pointOnFace);
+        if (!context.gradient || context.gradient.value().getNorm() == 0) {
+            if (fallbackGrad) {
+                context.gradient = *fallbackGrad;
+            } else {
+                context.gradient = tl::nullopt;
+            }
+        }
+        if (context.gradient) {
+            context.unitGradient = 1 / context.gradient.value().getNorm() * context.gradient.value();
+        }
+
+        context.n2 = refractIndex[context.nextElement->getId()];
+        context.n1 = context.previousElement ?
+                     refractIndex[context.previousElement->getId()] : std::min(context.n2, 1.0);
+        return context;
+    }
+
     /**
      * Functor that returns always the previousDirection.
      */
@@ -76,6 +216,13 @@ namespace raytracer {
                 const PointOnFace &,
                 const Vector &previousDirection
         );
+
+        /**
+         * Return the direction the ray came from
+         * @param context
+         * @return the direction
+         */
+        tl::optional<Vector> operator()(const CrossingContext &context);
     };
 
     template<typename MeshFunc>
@@ -98,31 +245,25 @@ namespace raytracer {
                 const Vector &direction
         ) {
             const auto nextElement = mesh->getFaceDirAdjElement(pointOnFace.face, direction);
-            //const auto prevElement = mesh->getFaceDirAdjElement(pointOnFace.face, -1 * direction);
-            if (!nextElement) return {};
-            //const double n1 = prevElement ? refractIndex->getValue(*prevElement) : 1.0;
-            //const double n2 = refractIndex->getValue(*nextElement);
-            if (dens[nextElement->getId()] > critDens) {
-                auto gradient = gradCalc->get(pointOnFace);
-                if (!gradient || gradient.value().getNorm() == 0) {
-                    if (fallbackGrad) {
-                        gradient = *fallbackGrad;
-                    } else {
-                        return {};
-                    }
-                }
-                auto unitGrad = 1 / gradient.value().getNorm() * gradient.value();
-                auto unitDir = 1 / direction.getNorm() * direction;
-                if (direction * gradient.value() < 0) {
-                    return direction;
-                } else {
-                    if (marker) {
-                        marker->mark(pointOnFace);
-                    }
-                    return impl::calcRayReflect(unitGrad, unitDir);
-                }
+            if (!nextElement || !(dens[nextElement->getId()] > critDens)) return {};
+            return (*this)(makeCrossingContext(*mesh, refractIndex, *gradCalc, fallbackGrad, pointOnFace, direction));
+        }
+
+        /**
+         * Reflect the ray if the next element is above critical density, the fallback gradient of the context is used
+         * @param context
+         * @return the reflected direction, the incoming direction if the ray goes against the gradient
+         */
+        tl::optional<Vector> operator()(const CrossingContext &context) {
+            if (!context.nextElement || !(dens[context.nextElement->getId()] > critDens)) return {};
+            if (!context.gradient) return {};
+            if (context.direction * context.gradient.value() < 0) {
+                return context.direction;
             } else {
-                return {};
+                if (marker) {
+                    marker->mark(*context.pointOnFace);
+                }
+                return impl::calcRayReflect(context.unitGradient, context.unitDirection);
             }
         }
 
@@ -174,24 +315,17 @@ namespace raytracer {
                 const PointOnFace &pointOnFace,
                 const Vector &direction
         ) {
-            const auto previousElement = mesh->getFaceDirAdjElement(pointOnFace.face, -1 * direction);
-            const auto nextElement = mesh->getFaceDirAdjElement(pointOnFace.face, direction);
-            if (!nextElement) return {};
-            auto gradient = gradCalc->get(pointOnFace);
-            if (!gradient || gradient.value().getNorm() == 0) {
-                if (fallbackGrad) {
-                    gradient = *fallbackGrad;
-                } else {
-                    return {};
-                }
-            }
-
-            const double n2 = refractIndex[nextElement->getId()];
-            const double n1 = previousElement ? refractIndex[previousElement->getId()] : std::min(n2, 1.0);
+            return (*this)(makeCrossingContext(*mesh, refractIndex, *gradCalc, fallbackGrad, pointOnFace, direction));
+        }
 
-            auto unitGrad = 1 / gradient.value().getNorm() * gradient.value();
-            auto unitDir = 1 / direction.getNorm() * direction;
-            return impl::calcRayBend(unitGrad, unitDir, n1, n2);
+        /**
+         * Apply Snells law using the context, its fallback gradient is used
+         * @param context
+         * @return new direction based on Snells law.
+         */
+        tl::optional<Vector> operator()(const CrossingContext &context) {
+            if (!context.nextElement || !context.gradient) return {};
+            return impl::calcRayBend(context.unitGradient, context.unitDirection, context.n1, context.n2);
         }
 
     private:
@@ -222,29 +356,22 @@ namespace raytracer {
                 const PointOnFace &pointOnFace,
                 const Vector &direction
         ) {
-            const auto previousElement = mesh->getFaceDirAdjElement(pointOnFace.face, -1 * direction);
-            const auto nextElement = mesh->getFaceDirAdjElement(pointOnFace.face, direction);
-            if (!nextElement) return {};
-            auto gradient = gradCalc->get(pointOnFace);
-            if (!gradient || gradient.value().getNorm() == 0) {
-                if (fallbackGrad) {
-                    gradient = *fallbackGrad;
-                } else {
-                    return {};
-                }
-            }
-
-            const double n2 = refractIndex[nextElement->getId()];
-            const double n1 = previousElement ? refractIndex[previousElement->getId()] : std::min(n2, 1.0);
+            return (*this)(makeCrossingContext(*mesh, refractIndex, *gradCalc, fallbackGrad, pointOnFace, direction));
+        }
 
-            auto unitGrad = 1 / gradient.value().getNorm() * gradient.value();
-            auto unitDir = 1 / direction.getNorm() * direction;
-            if (impl::shouldReflect(unitGrad, unitDir, n1, n2)) {
-                if (gradient.value() * direction < 0) {
-                    return direction;
+        /**
+         * Reflect the ray if it should be totally reflected, the fallback gradient of the context is used
+         * @param context
+         * @return the reflected direction, the incoming direction if the ray goes against the gradient
+         */
+        tl::optional<Vector> operator()(const CrossingContext &context) {
+            if (!context.nextElement || !context.gradient) return {};
+            if (impl::shouldReflect(context.unitGradient, context.unitDirection, context.n1, context.n2)) {
+                if (context.gradient.value() * context.direction < 0) {
+                    return context.direction;
                 } else {
-                    if (reflectMarker) reflectMarker->mark(pointOnFace);
-                    return impl::calcRayReflect(unitGrad, unitDir);
+                    if (reflectMarker) reflectMarker->mark(*context.pointOnFace);
+                    return impl::calcRayReflect(context.unitGradient, context.unitDirection);
                 }
             } else {
                 return {};
@@ -258,6 +385,67 @@ namespace raytracer {
         Marker *reflectMarker{};
         Vector *fallbackGrad{};
     };
+
+    namespace impl {
+        template<std::size_t Index, std::size_t Size>
+        struct ContextChainStep {
+            template<typename Functions>
+            static tl::optional<Vector> apply(Functions &functions, const CrossingContext &context) {
+                tl::optional<Vector> result = std::get<Index>(functions)(context);
+                if (result) return result;
+                return ContextChainStep<Index + 1, Size>::apply(functions, context);
+            }
+        };
+
+        template<std::size_t Size>
+        struct ContextChainStep<Size, Size> {
+            template<typename Functions>
+            static tl::optional<Vector> apply(Functions &, const CrossingContext &) {
+                return {};
+            }
+        };
+    }
+
+    /**
+     * Direction function calculating the CrossingContext once per crossing and passing it to a chain
+     * of functions callable as tl::optional<Vector>(const CrossingContext&), the first one returning
+     * a direction wins. Use makeRefractionChain to create it.
+     * @tparam MeshFunc type of the refractive index
+     * @tparam Functions e.g. TotalReflect, ReflectOnCritical, SnellsLawBend, ContinueStraight
+     */
+    template<typename MeshFunc, typename... Functions>
+    struct RefractionChain {
+        const Mesh *mesh;
+        MeshFunc refractIndex;
+        const Gradient *gradCalc;
+        const Vector *fallbackGrad;
+        std::tuple<Functions...> functions;
+
+        tl::optional<Vector> operator()(const PointOnFace &pointOnFace, const Vector &direction) {
+            auto context = makeCrossingContext(*mesh, refractIndex, *gradCalc, fallbackGrad, pointOnFace, direction);
+            return impl::ContextChainStep<0, sizeof...(Functions)>::apply(functions, context);
+        }
+    };
+
+    /**
+     * Create a RefractionChain
+     * @param mesh
+     * @param refractIndex
+     * @param gradCalc
+     * @param fallbackGrad used by all the functions if the gradient is not known, may be nullptr
+     * @param functions the chain, their own mesh, refractive index, gradient and fallback gradient are not used
+     * @return the chain usable as a direction function
+     */
+    template<typename MeshFunc, typename... Functions>
+    RefractionChain<MeshFunc, Functions...> makeRefractionChain(
+            const Mesh *mesh,
+            const MeshFunc &refractIndex,
+            const Gradient *gradCalc,
+            const Vector *fallbackGrad,
+            Functions... functions
+    ) {
+        return {mesh, refractIndex, gradCalc, fallbackGrad, std::make_tuple(std::move(functions)...)};
+    }
 }
 
 #endif //RAYTRACER_REFRACTION_H
@@ -1,6 +1,7 @@
 #ifndef RAYTRACER_TERMINATION_H
 #define RAYTRACER_TERMINATION_H
 
+#include <cstdint>
 #include <geometry.h>
 #include "gradient.h"
 #include "collisional_frequency.h"
@@ -43,6 +44,63 @@ namespace raytracer {
      */
     bool dontStop(const Element &);
 
+    /** What StopAtPower decided about a ray */
+    enum class PowerFate {
+        /** The ray has enough power and continues */
+        Keep,
+        /** The ray fell below the threshold and was stopped */
+        CutOff,
+        /** The ray lost the russian roulette and was stopped */
+        Killed,
+        /** The ray won the russian roulette and continues with its power raised */
+        Survived
+    };
+
+    /**
+     * Functor stopping rays whose power fell below a threshold, used by traceAndExchange.
+     * The threshold is the larger of an absolute power and a fraction of the initial power of the ray.
+     * Without russian roulette a ray below the threshold is cut off and the power it has left is deposited
+     * into the element it was about to enter, which keeps the energy but moves it slightly downstream.
+     * With russian roulette a ray below the threshold survives with survivalProbability and its power is divided
+     * by it, otherwise it is stopped with its power lost. The deposited energy is then the same as without
+     * any stopping on average. The roulette draws are given by the seed and the crossing id, so they do not
+     * depend on the number of threads.
+     */
+    struct StopAtPower {
+        /**
+         * Declare the threshold without russian roulette
+         * @param absolute ray is stopped below this power
+         * @param relative ray is stopped below this fraction of its initial power
+         */
+        explicit StopAtPower(Power absolute, double relative = 0);
+
+        /**
+         * Declare the threshold with russian roulette
+         * @param absolute ray is stopped below this power
+         * @param relative ray is stopped below this fraction of its initial power
+         * @param survivalProbability probability of surviving the russian roulette, 0 turns the roulette off
+         * @param seed of the roulette draws. Crossing ids repeat in every timestep, so the seed must be different
+         * in each of them, e.g. a hash of the timestep index, otherwise the same rays are killed every time.
+         * @throws std::logic_error if the survivalProbability is not in [0, 1]
+         */
+        StopAtPower(Power absolute, double relative, double survivalProbability, std::uint64_t seed);
+
+        /**
+         * Decide about the ray at a crossing
+         * @param currentPower power of the ray, raised if the ray survived the roulette
+         * @param initialPower power the ray started with
+         * @param crossingId id of the crossing the ray is at, see getCrossingId
+         * @return the decision
+         */
+        PowerFate operator()(double &currentPower, double initialPower, std::int64_t crossingId) const;
+
+    private:
+        double absolute;
+        double relative;
+        double survivalProbability;
+        std::uint64_t seed;
+    };
+
 }
 
 #endif //RAYTRACER_TERMINATION_H
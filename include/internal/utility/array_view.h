@@ -0,0 +1,61 @@
+#ifndef RAYTRACER_ARRAY_VIEW_H
+#define RAYTRACER_ARRAY_VIEW_H
+
+#include <cstddef>
+#include <vector>
+
+namespace raytracer {
+    /**
+     * Non-owning read only view of a contiguous sequence, e.g. of a std::vector.
+     * The view is only valid as long as the viewed storage is alive and is not reallocated.
+     * @tparam T type of the viewed values
+     */
+    template<typename T>
+    class ArrayView {
+    public:
+        using value_type = T;
+        using size_type = std::size_t;
+        using const_reference = const T &;
+        using reference = const T &;
+        using const_iterator = const T *;
+        using iterator = const T *;
+
+        /** Empty view */
+        ArrayView() = default;
+
+        /**
+         * View of count values starting at data
+         * @param data
+         * @param count
+         */
+        ArrayView(const T *data, std::size_t count) : first(data), count(count) {}
+
+        /**
+         * View of the whole vector
+         * @param vector
+         */
+        ArrayView(const std::vector<T> &vector) : first(vector.data()), count(vector.size()) {}
+
+        const_iterator begin() const { return first; }
+
+        const_iterator end() const { return first + count; }
+
+        std::size_t size() const { return count; }
+
+        bool empty() const { return count == 0; }
+
+        const T &operator[](std::size_t index) const { return first[index]; }
+
+        const T &front() const { return first[0]; }
+
+        const T &back() const { return first[count - 1]; }
+
+        const T *data() const { return first; }
+
+    private:
+        const T *first{};
+        std::size_t count{};
+    };
+}
+
+#endif //RAYTRACER_ARRAY_VIEW_H
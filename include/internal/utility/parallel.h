@@ -0,0 +1,136 @@
+#ifndef RAYTRACER_PARALLEL_H
+#define RAYTRACER_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer {
+    /**
+     * Number of threads the hardware can run concurrently.
+     * @return threads count, at least 1
+     */
+    unsigned getHardwareThreadsCount();
+
+    namespace impl {
+        unsigned resolveThreadsCount(unsigned threadsCount, std::size_t count);
+
+        template<typename Worker>
+        void runWorkers(unsigned workersCount, Worker &&worker) {
+            std::exception_ptr error;
+            std::mutex errorMutex;
+            auto guardedWorker = [&](unsigned workerIndex) {
+                try {
+                    worker(workerIndex);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                }
+            };
+
+            std::vector<std::thread> threads;
+            threads.reserve(workersCount - 1);
+            for (unsigned workerIndex = 1; workerIndex < workersCount; ++workerIndex) {
+                threads.emplace_back(guardedWorker, workerIndex);
+            }
+            guardedWorker(0);
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    /**
+     * Call func(i) for every i in [0, count) using multiple threads.
+     * Indices are handed out dynamically in small chunks so that the load stays balanced even if
+     * the calls take very different time (e.g. rays of different length). The func must be safe
+     * to call concurrently for different indices. If any call throws, remaining indices are skipped
+     * and the first exception is rethrown in the calling thread once all threads finished.
+     *
+     * @param count number of indices
+     * @param threadsCount number of threads to use, 1 runs everything in the calling thread,
+     * 0 means getHardwareThreadsCount()
+     * @param func void(std::size_t index)
+     */
+    template<typename Func>
+    void parallelFor(std::size_t count, unsigned threadsCount, Func &&func) {
+        auto workersCount = impl::resolveThreadsCount(threadsCount, count);
+        if (workersCount == 1) {
+            for (std::size_t i = 0; i < count; ++i) func(i);
+            return;
+        }
+
+        const std::size_t chunkSize = std::max<std::size_t>(1, count / (16 * workersCount));
+        std::atomic<std::size_t> nextIndex{0};
+        std::atomic<bool> failed{false};
+        impl::runWorkers(workersCount, [&](unsigned) {
+            while (!failed) {
+                std::size_t begin = nextIndex.fetch_add(chunkSize);
+                if (begin >= count) break;
+                std::size_t end = std::min(count, begin + chunkSize);
+                try {
+                    for (std::size_t i = begin; i < end; ++i) func(i);
+                } catch (...) {
+                    failed = true;
+                    throw;
+                }
+            }
+        });
+    }
+
+    /**
+     * Split [0, count) into contiguous ranges, one per thread, and call func(begin, end, rangeIndex)
+     * for each of them concurrently. Unlike parallelFor the split is fixed, so per range results
+     * merged in the order of rangeIndex are deterministic for a given threadsCount.
+     *
+     * @param count number of indices
+     * @param threadsCount number of threads (and ranges), 0 means getHardwareThreadsCount()
+     * @param func void(std::size_t begin, std::size_t end, unsigned rangeIndex)
+     * @return number of ranges used
+     */
+    template<typename Func>
+    unsigned parallelForRanges(std::size_t count, unsigned threadsCount, Func &&func) {
+        auto rangesCount = impl::resolveThreadsCount(threadsCount, count);
+        auto rangeBegin = [count, rangesCount](unsigned rangeIndex) {
+            return count * rangeIndex / rangesCount;
+        };
+        if (rangesCount == 1) {
+            func(std::size_t{0}, count, 0u);
+        } else {
+            impl::runWorkers(rangesCount, [&](unsigned rangeIndex) {
+                func(rangeBegin(rangeIndex), rangeBegin(rangeIndex + 1), rangeIndex);
+            });
+        }
+        return rangesCount;
+    }
+
+    /**
+     * Add each value to the bin given by its index using multiple threads, i.e. bins[indices[i]] += values[i].
+     * Every thread owns a range of bins. The values are processed in blocks of 2^16 values per thread, each block
+     * is partitioned by the bin ranges keeping the order of the values and every bin is then summed up by a single
+     * thread in the original order. The result is therefore bit for bit the same as that of the serial loop,
+     * regardless of threadsCount, and the memory needed besides the result does not grow with the number of values
+     * or bins.
+     *
+     * @param indices bin of each value, negative indices are skipped
+     * @param values values to add
+     * @param binsCount number of bins, every index must be less than that
+     * @param threadsCount number of threads, 0 means getHardwareThreadsCount()
+     * @return sums of the bins
+     * @throws std::logic_error if indices and values have different sizes
+     */
+    std::vector<double> parallelScatterAdd(
+            const std::vector<std::int32_t> &indices,
+            const std::vector<double> &values,
+            std::size_t binsCount,
+            unsigned threadsCount = 1
+    );
+}
+
+#endif //RAYTRACER_PARALLEL_H
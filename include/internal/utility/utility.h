@@ -4,5 +4,7 @@
 #include "numeric.h"
 #include "polyfills.h"
 #include "optional.h"
+#include "parallel.h"
+#include "array_view.h"
 
 #endif //RAYTRACER_UTILITY_H
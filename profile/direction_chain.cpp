@@ -0,0 +1,66 @@
+#include <raytracer.h>
+#include <chrono>
+
+int main(int, char *[]) {
+    using namespace raytracer;
+    using timePoint = std::chrono::steady_clock::time_point;
+    using namespace std::chrono;
+
+    MfemMesh mesh(SegmentedLine{0.0, 1.0, 500}, SegmentedLine{0.0, 1.0, 100});
+    Length wavelength{1315e-7};
+    auto critDens = calcCritDens(wavelength).asDouble;
+
+    std::vector<double> density(mesh.getElements().size());
+    std::vector<double> refractIndex(mesh.getElements().size());
+    for (const auto &element : mesh.getElements()) {
+        auto x = getElementCentroid(*element).x;
+        density[element->getId()] = critDens * (1 - (x - 1) * (x - 1));
+        refractIndex[element->getId()] = calcRefractIndex(density[element->getId()], wavelength, 0);
+    }
+    LinInterGrad gradient{calcHousGrad(mesh, density)};
+
+    TotalReflect<std::vector<double>> totalReflect(&mesh, refractIndex, &gradient);
+    ReflectOnCritical<std::vector<double>> reflectOnCritical(&mesh, refractIndex, density, critDens, &gradient);
+    SnellsLawBend<std::vector<double>> snellsLaw(&mesh, refractIndex, &gradient);
+
+    int laserCount = 10000;
+    std::vector<Ray> initDirs;
+    initDirs.reserve(laserCount);
+    for (int i = 0; i < laserCount; i++) {
+        initDirs.emplace_back(Ray{{-0.1, 0.01 + 0.98 * i / laserCount}, Vector{1, 0.3}});
+    }
+
+    timePoint begin = steady_clock::now();
+    auto functionSet = findIntersections(
+            mesh, initDirs, {totalReflect, reflectOnCritical, snellsLaw}, intersectStraight, dontStop
+    );
+    timePoint end = steady_clock::now();
+    std::cout << "std::function chain: " << duration_cast<microseconds>(end - begin).count() * 1e-6 << " s"
+              << std::endl;
+
+    begin = steady_clock::now();
+    auto tupleSet = findIntersections(
+            mesh, initDirs, std::make_tuple(totalReflect, reflectOnCritical, snellsLaw), intersectStraight, dontStop
+    );
+    end = steady_clock::now();
+    std::cout << "tuple chain: " << duration_cast<microseconds>(end - begin).count() * 1e-6 << " s" << std::endl;
+
+    begin = steady_clock::now();
+    auto refractionChain = makeRefractionChain(
+            &mesh, refractIndex, &gradient, nullptr, totalReflect, reflectOnCritical, snellsLaw
+    );
+    auto contextSet = findIntersections(
+            mesh, initDirs, std::make_tuple(refractionChain), intersectStraight, dontStop
+    );
+    end = steady_clock::now();
+    std::cout << "refraction chain: " << duration_cast<microseconds>(end - begin).count() * 1e-6 << " s" << std::endl;
+
+    std::size_t functionCount = 0, tupleCount = 0, contextCount = 0;
+    for (std::size_t i = 0; i < functionSet.size(); i++) {
+        functionCount += functionSet[i].size();
+        tupleCount += tupleSet[i].size();
+        contextCount += contextSet[i].size();
+    }
+    std::cout << "Found " << functionCount << ", " << tupleCount << " and " << contextCount << " intersections"
+              << std::endl;
+}
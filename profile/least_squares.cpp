@@ -0,0 +1,48 @@
+#include <raytracer.h>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+int main(int argc, char *argv[]) {
+    using namespace raytracer;
+    using namespace std::chrono;
+
+    auto systemsCount = argc > 1 ? static_cast<std::size_t>(std::atof(argv[1])) : 1000000;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> distribution(-1, 1);
+
+    for (int rowsCount : {4, 6, 8}) {
+        std::vector<double> coefficients(systemsCount * rowsCount * 4);
+        for (auto &coefficient : coefficients) coefficient = distribution(generator);
+
+        double checksum = 0;
+        auto begin = steady_clock::now();
+        for (std::size_t system = 0; system < systemsCount; ++system) {
+            const double *row = &coefficients[system * rowsCount * 4];
+            rosetta::Matrix A(rowsCount, 3);
+            rosetta::Matrix b(rowsCount, 1);
+            for (int i = 0; i < rowsCount; ++i, row += 4) {
+                A(i, 0) = 1;
+                A(i, 1) = row[1];
+                A(i, 2) = row[2];
+                b(i, 0) = row[3];
+            }
+            checksum += impl::solveOverdetermined(A, b).x;
+        }
+        auto middle = steady_clock::now();
+        for (std::size_t system = 0; system < systemsCount; ++system) {
+            const double *row = &coefficients[system * rowsCount * 4];
+            SmallLeastSquares<16> leastSquares;
+            for (int i = 0; i < rowsCount; ++i, row += 4) {
+                leastSquares.addRow(1, row[1], row[2], row[3]);
+            }
+            checksum -= leastSquares.solve()[1];
+        }
+        auto end = steady_clock::now();
+
+        std::cout << systemsCount << " systems of " << rowsCount << " rows: rosetta "
+                  << duration_cast<microseconds>(middle - begin).count() * 1e-6 << " s, stack "
+                  << duration_cast<microseconds>(end - middle).count() * 1e-6 << " s, checksum "
+                  << checksum << std::endl;
+    }
+}
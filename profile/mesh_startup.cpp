@@ -0,0 +1,25 @@
+#include <raytracer.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+int main(int argc, char *argv[]) {
+    using namespace raytracer;
+    using namespace std::chrono;
+
+    double maxElements = argc > 1 ? std::atof(argv[1]) : 1e7;
+    auto threadsCount = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 1u;
+    for (double elementsCount = 1e4; elementsCount <= maxElements; elementsCount *= 10) {
+        auto side = static_cast<size_t>(std::round(std::sqrt(elementsCount)));
+        auto begin = steady_clock::now();
+        MfemMesh mesh(
+                SegmentedLine{0.0, 1.0, side},
+                SegmentedLine{0.0, 1.0, side},
+                mfem::Element::Type::QUADRILATERAL,
+                threadsCount
+        );
+        auto end = steady_clock::now();
+        std::cout << mesh.getElements().size() << " elements, " << mesh.getPoints().size() << " points: "
+                  << duration_cast<microseconds>(end - begin).count() * 1e-6 << " s" << std::endl;
+    }
+}
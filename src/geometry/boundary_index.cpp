@@ -0,0 +1,153 @@
+#include "boundary_index.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "intersection.h"
+
+namespace raytracer {
+    BoundaryIndex::BoundaryIndex(std::vector<Face *> boundaryFaces) : faces(std::move(boundaryFaces)) {
+        if (faces.empty()) return;
+        std::vector<Point> centroids;
+        centroids.reserve(faces.size());
+        order.reserve(faces.size());
+        for (std::size_t i = 0; i < faces.size(); ++i) {
+            const auto &points = faces[i]->getPoints();
+            if (points.size() != 2) throw std::logic_error("Boundary index supports only faces with two points!");
+            centroids.emplace_back(Point(0.5 * (Vector(*points[0]) + Vector(*points[1]))));
+            order.emplace_back(i);
+        }
+        nodes.reserve(2 * faces.size());
+        this->build(0, faces.size(), centroids);
+    }
+
+    std::size_t BoundaryIndex::build(std::size_t begin, std::size_t end, const std::vector<Point> &centroids) {
+        const std::size_t leafSize = 4;
+        auto nodeIndex = nodes.size();
+        nodes.emplace_back();
+
+        auto inf = std::numeric_limits<double>::infinity();
+        double minX = inf, minY = inf, maxX = -inf, maxY = -inf;
+        for (auto i = begin; i < end; ++i) {
+            for (const auto point : faces[order[i]]->getPoints()) {
+                minX = std::min(minX, point->x);
+                minY = std::min(minY, point->y);
+                maxX = std::max(maxX, point->x);
+                maxY = std::max(maxY, point->y);
+            }
+        }
+        // Pad the box so that rounding in the slab test never rejects a face the exact test would hit
+        auto pad = 1e-9 * std::max({maxX - minX, maxY - minY, std::abs(minX), std::abs(minY),
+                                    std::abs(maxX), std::abs(maxY)});
+        Node node{minX - pad, minY - pad, maxX + pad, maxY + pad, begin, end - begin};
+
+        if (end - begin > leafSize) {
+            auto middle = begin + (end - begin) / 2;
+            bool splitX = maxX - minX >= maxY - minY;
+            std::nth_element(
+                    order.begin() + begin,
+                    order.begin() + middle,
+                    order.begin() + end,
+                    [&centroids, splitX](std::size_t a, std::size_t b) {
+                        return splitX ? centroids[a].x < centroids[b].x : centroids[a].y < centroids[b].y;
+                    }
+            );
+            this->build(begin, middle, centroids);
+            node.index = this->build(middle, end, centroids);
+            node.count = 0;
+        }
+        nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    bool BoundaryIndex::isHit(const Node &node, const Ray &ray, double &entryParam) const {
+        double tNear = -std::numeric_limits<double>::infinity();
+        double tFar = std::numeric_limits<double>::infinity();
+        const double origin[2] = {ray.origin.x, ray.origin.y};
+        const double direction[2] = {ray.direction.x, ray.direction.y};
+        const double boxMin[2] = {node.minX, node.minY};
+        const double boxMax[2] = {node.maxX, node.maxY};
+        for (int axis = 0; axis < 2; ++axis) {
+            if (direction[axis] == 0) {
+                if (origin[axis] < boxMin[axis] || origin[axis] > boxMax[axis]) return false;
+            } else {
+                double t1 = (boxMin[axis] - origin[axis]) / direction[axis];
+                double t2 = (boxMax[axis] - origin[axis]) / direction[axis];
+                if (t1 > t2) std::swap(t1, t2);
+                tNear = std::max(tNear, t1);
+                tFar = std::min(tFar, t2);
+            }
+        }
+        if (tFar < tNear || tFar < 0) return false;
+        entryParam = std::max(tNear, 0.0);
+        return true;
+    }
+
+    bool BoundaryIndex::findEntryPoint(const Ray &ray, PointOnFace &result) const {
+        if (nodes.empty()) return false;
+        const auto rayNormal = ray.direction.getNormal();
+        const auto direction2 = ray.direction.getNorm2();
+        impl::ClosestFaceHit closest;
+
+        // The depth of a median split tree never exceeds the bits of std::size_t
+        std::size_t stack[64];
+        double stackParams[64];
+        std::size_t stackSize = 0;
+        double rootParam;
+        if (isHit(nodes[0], ray, rootParam)) {
+            stack[stackSize] = 0;
+            stackParams[stackSize++] = rootParam;
+        }
+        while (stackSize > 0) {
+            --stackSize;
+            const auto nodeIndex = stack[stackSize];
+            const auto &node = nodes[nodeIndex];
+            // Skip the box if even its closest point is farther than the best hit, with a margin for rounding
+            auto entryDistance2 = stackParams[stackSize] * stackParams[stackSize] * direction2;
+            if (entryDistance2 > closest.getDistance2() * (1 + 1e-9)) continue;
+
+            if (node.count > 0) {
+                for (auto i = node.index; i < node.index + node.count; ++i) {
+                    const auto faceOrder = order[i];
+                    Point point;
+                    double t;
+                    if (impl::intersectFace(ray, rayNormal, *faces[faceOrder], 0, 1, point, t)) {
+                        closest.add(ray, faces[faceOrder], faceOrder, point, t, true);
+                    }
+                }
+            } else {
+                const std::size_t children[2] = {nodeIndex + 1, node.index};
+                double params[2] = {0, 0};
+                const bool hits[2] = {
+                        isHit(nodes[children[0]], ray, params[0]),
+                        isHit(nodes[children[1]], ray, params[1])
+                };
+                // Push the farther child first so that the nearer one is visited first
+                const int nearer = hits[1] && (!hits[0] || params[1] < params[0]) ? 1 : 0;
+                for (int child : {1 - nearer, nearer}) {
+                    if (hits[child]) {
+                        stack[stackSize] = children[child];
+                        stackParams[stackSize++] = params[child];
+                    }
+                }
+            }
+        }
+        return closest.get(result);
+    }
+
+    std::vector<tl::optional<PointOnFace>> BoundaryIndex::findEntryPoints(
+            const std::vector<Ray> &rays,
+            unsigned threadsCount
+    ) const {
+        std::vector<tl::optional<PointOnFace>> result(rays.size());
+        parallelFor(rays.size(), threadsCount, [&](std::size_t i) {
+            PointOnFace pointOnFace{};
+            if (findEntryPoint(rays[i], pointOnFace)) result[i] = pointOnFace;
+        });
+        return result;
+    }
+
+    const std::vector<Face *> &BoundaryIndex::getFaces() const {
+        return faces;
+    }
+}
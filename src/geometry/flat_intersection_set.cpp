@@ -0,0 +1,156 @@
+#include "flat_intersection_set.h"
+#include <algorithm>
+
+namespace raytracer {
+    std::int32_t getIdOrNone(const Element *element) {
+        return element ? element->getId() : -1;
+    }
+
+    FlatIntersectionSet::FlatIntersectionSet(const Mesh &mesh) : mesh(&mesh), offsets{0} {}
+
+    FlatIntersectionSet::FlatIntersectionSet(const Mesh &mesh, const IntersectionSet &intersectionSet) :
+            FlatIntersectionSet(mesh) {
+        std::size_t intersectionsCount = 0;
+        for (const auto &intersections : intersectionSet) {
+            intersectionsCount += intersections.size();
+        }
+        offsets.reserve(intersectionSet.size() + 1);
+        rayFirstIds.reserve(intersectionSet.size());
+        x.reserve(intersectionsCount);
+        y.reserve(intersectionsCount);
+        directionX.reserve(intersectionsCount);
+        directionY.reserve(intersectionsCount);
+        faceIds.reserve(intersectionsCount);
+        nextElementIds.reserve(intersectionsCount);
+        previousElementIds.reserve(intersectionsCount);
+
+        for (const auto &intersections : intersectionSet) {
+            for (const auto &intersection : intersections) {
+                this->append(intersection);
+            }
+            this->endRay();
+        }
+    }
+
+    void FlatIntersectionSet::append(const Intersection &intersection) {
+        const auto &pointOnFace = intersection.pointOnFace;
+        if (x.size() == offsets.back()) rayFirstIds.emplace_back(pointOnFace.id);
+        x.emplace_back(pointOnFace.point.x);
+        y.emplace_back(pointOnFace.point.y);
+        directionX.emplace_back(intersection.direction.x);
+        directionY.emplace_back(intersection.direction.y);
+        faceIds.emplace_back(pointOnFace.face ? pointOnFace.face->getId() : -1);
+        nextElementIds.emplace_back(getIdOrNone(intersection.nextElement));
+        previousElementIds.emplace_back(getIdOrNone(intersection.previousElement));
+    }
+
+    void FlatIntersectionSet::endRay() {
+        if (x.size() == offsets.back()) rayFirstIds.emplace_back(-1);
+        offsets.emplace_back(x.size());
+    }
+
+    void FlatIntersectionSet::append(const FlatIntersectionSet &other) {
+        auto shift = x.size();
+        for (auto it = std::next(other.offsets.begin()); it != other.offsets.end(); ++it) {
+            offsets.emplace_back(*it + shift);
+        }
+        rayFirstIds.insert(rayFirstIds.end(), other.rayFirstIds.begin(), other.rayFirstIds.end());
+        x.insert(x.end(), other.x.begin(), other.x.end());
+        y.insert(y.end(), other.y.begin(), other.y.end());
+        directionX.insert(directionX.end(), other.directionX.begin(), other.directionX.end());
+        directionY.insert(directionY.end(), other.directionY.begin(), other.directionY.end());
+        faceIds.insert(faceIds.end(), other.faceIds.begin(), other.faceIds.end());
+        nextElementIds.insert(nextElementIds.end(), other.nextElementIds.begin(), other.nextElementIds.end());
+        previousElementIds.insert(
+                previousElementIds.end(),
+                other.previousElementIds.begin(),
+                other.previousElementIds.end()
+        );
+    }
+
+    template<typename T>
+    void FlatIntersectionSet::appendColumn(
+            std::vector<T> FlatIntersectionSet::*column,
+            std::vector<FlatIntersectionSet> &parts,
+            const std::vector<std::size_t> &partBegins,
+            unsigned threadsCount
+    ) {
+        auto &result = this->*column;
+        result.resize(partBegins.back());
+        parallelFor(parts.size(), threadsCount, [&](std::size_t partIndex) {
+            auto &partColumn = parts[partIndex].*column;
+            std::copy(partColumn.begin(), partColumn.end(), result.begin() + partBegins[partIndex]);
+            std::vector<T>().swap(partColumn);
+        });
+    }
+
+    void FlatIntersectionSet::append(std::vector<FlatIntersectionSet> &&parts, unsigned threadsCount) {
+        std::vector<std::size_t> partBegins{x.size()};
+        partBegins.reserve(parts.size() + 1);
+        for (const auto &part : parts) {
+            for (auto it = std::next(part.offsets.begin()); it != part.offsets.end(); ++it) {
+                offsets.emplace_back(*it + partBegins.back());
+            }
+            rayFirstIds.insert(rayFirstIds.end(), part.rayFirstIds.begin(), part.rayFirstIds.end());
+            partBegins.emplace_back(partBegins.back() + part.getIntersectionsCount());
+        }
+        appendColumn(&FlatIntersectionSet::x, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::y, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::directionX, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::directionY, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::faceIds, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::nextElementIds, parts, partBegins, threadsCount);
+        appendColumn(&FlatIntersectionSet::previousElementIds, parts, partBegins, threadsCount);
+        parts.clear();
+    }
+
+    std::size_t FlatIntersectionSet::getRaysCount() const {
+        return offsets.size() - 1;
+    }
+
+    std::size_t FlatIntersectionSet::getIntersectionsCount() const {
+        return x.size();
+    }
+
+    std::size_t FlatIntersectionSet::getRayBegin(std::size_t rayIndex) const {
+        return offsets[rayIndex];
+    }
+
+    std::size_t FlatIntersectionSet::getRayEnd(std::size_t rayIndex) const {
+        return offsets[rayIndex + 1];
+    }
+
+    Intersection FlatIntersectionSet::getIntersection(std::size_t index) const {
+        auto rayIndex = std::upper_bound(offsets.begin(), offsets.end(), index) - offsets.begin() - 1;
+        return getIntersection(static_cast<std::size_t>(rayIndex), index);
+    }
+
+    Intersection FlatIntersectionSet::getIntersection(std::size_t rayIndex, std::size_t index) const {
+        Intersection result;
+        result.direction = getDirection(index);
+        result.pointOnFace.point = Point(x[index], y[index]);
+        result.pointOnFace.face = faceIds[index] < 0 ? nullptr : mesh->getFaceFromId(faceIds[index]);
+        result.pointOnFace.id = rayFirstIds[rayIndex] + static_cast<std::int64_t>(index - offsets[rayIndex]);
+        result.nextElement = mesh->getElementFromId(nextElementIds[index]);
+        result.previousElement = mesh->getElementFromId(previousElementIds[index]);
+        return result;
+    }
+
+    IntersectionSet FlatIntersectionSet::toIntersectionSet() const {
+        IntersectionSet result;
+        result.reserve(getRaysCount());
+        for (std::size_t rayIndex = 0; rayIndex < getRaysCount(); ++rayIndex) {
+            Intersections intersections;
+            intersections.reserve(getRayEnd(rayIndex) - getRayBegin(rayIndex));
+            for (auto i = getRayBegin(rayIndex); i < getRayEnd(rayIndex); ++i) {
+                intersections.emplace_back(getIntersection(rayIndex, i));
+            }
+            result.emplace_back(std::move(intersections));
+        }
+        return result;
+    }
+
+    const Mesh &FlatIntersectionSet::getMesh() const {
+        return *mesh;
+    }
+}
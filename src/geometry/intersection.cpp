@@ -7,99 +7,95 @@
 namespace raytracer {
 
 
-    double getParamK(const Ray &ray,
-                     const std::vector<Point *> &points) {
-        auto normal = ray.direction.getNormal();
+    bool impl::intersectFace(
+            const Ray &ray,
+            const Vector &rayNormal,
+            const Face &face,
+            double kMin,
+            double kMax,
+            Point &point,
+            double &t
+    ) {
+        const auto &points = face.getPoints();
+        if (points.size() != 2) throw std::logic_error("Can get face intersection!");
         const auto &P = ray.origin;
         const auto &A = *points[0];
-        const auto &B = *points[1];
-        return (normal * (P - A)) / (normal * (B - A));
-    }
-
-    double getParamT(const Ray &ray,
-                     const std::vector<Point *> &points) {
-        const auto &A = *points[0];
-        const auto &B = *points[1];
-        auto normal = (B - A).getNormal();
-        const auto &d = ray.direction;
-        const auto &P = ray.origin;
+        const auto AB = *points[1] - A;
 
-        return (normal * (A - P)) / (normal * d);
+        const double k = (rayNormal * (P - A)) / (rayNormal * AB);
+        if (!(k >= kMin && k <= kMax)) return false;
+        const auto faceNormal = AB.getNormal();
+        t = (faceNormal * (A - P)) / (faceNormal * ray.direction);
+        point = Point(Vector(A) + k * AB);
+        return true;
     }
 
-    bool isIntersecting(double k, double t, bool includePoint) {
-        if (!includePoint) {
-            return k >= 0 && k <= 1 && t > 0;
-        } else {
-            return k >= 0 && k <= 1 && t >= 0;
+    void impl::ClosestFaceHit::add(
+            const Ray &ray,
+            const Face *face,
+            std::size_t order,
+            const Point &point,
+            double t,
+            bool includeOrigin
+    ) {
+        if (t > 0) {
+            auto distance2 = (point - ray.origin).getNorm2();
+            if (distance2 < hitDistance2 || (distance2 == hitDistance2 && order >= hitOrder)) {
+                hitFace = face;
+                hitPoint = point;
+                hitDistance2 = distance2;
+                hitOrder = order;
+            }
+        } else if (t >= 0 && includeOrigin && !hitFace) {
+            auto distance2 = (point - ray.origin).getNorm2();
+            if (distance2 < touchDistance2 || (distance2 == touchDistance2 && order >= touchOrder)) {
+                touchFace = face;
+                touchPoint = point;
+                touchDistance2 = distance2;
+                touchOrder = order;
+            }
         }
     }
 
-    PointOnFacePtr getClosest(std::vector<PointOnFacePtr> &intersections, const Point &point) {
-        static int currentId = 0;
-        PointOnFacePtr result = nullptr;
-        auto distance2 = std::numeric_limits<double>::infinity();
-        for (auto &pointOnFace : intersections) {
-            if (pointOnFace) {
-                auto norm2 = (pointOnFace->point - point).getNorm2();
-                if (norm2 <= distance2) {
-                    result = std::move(pointOnFace);
-                    distance2 = norm2;
-                }
-            }
-        }
-        if (result) {
-            result->id = currentId++;
+    bool impl::ClosestFaceHit::get(PointOnFace &result) const {
+        if (hitFace) {
+            result.point = hitPoint;
+            result.face = hitFace;
+        } else if (touchFace) {
+            result.point = touchPoint;
+            result.face = touchFace;
+        } else {
+            return false;
         }
-        return result;
+        // Not a crossing of a traced ray until traceRay gives it its id
+        result.id = -1;
+        return true;
     }
 
-    PointOnFacePtr findIntersectionPoint(const Ray &ray, const Face *face, bool includePoint = false) {
-        const auto &points = face->getPoints();
-        if (points.size() == 2) {
-            const double k = getParamK(ray, points);
-            const double t = getParamT(ray, points);
-
-            if (isIntersecting(k, t, includePoint)) {
-                const auto &A = *points[0];
-                const auto &B = *points[1];
-                auto point = Point(Vector(A) + k * (B - A));
-                auto pointOnFace = make_unique<PointOnFace>();
-                pointOnFace->point = point;
-                pointOnFace->face = face;
-
-                return pointOnFace;
-            } else {
-                return nullptr;
+    bool findExitPoint(
+            const Ray &ray,
+            ArrayView<Face *> faces,
+            const Face *skippedFace,
+            PointOnFace &result,
+            const IntersectionTolerance &tolerance
+    ) {
+        const auto rayNormal = ray.direction.getNormal();
+        impl::ClosestFaceHit closest;
+        for (std::size_t i = 0; i < faces.size(); ++i) {
+            if (faces[i] == skippedFace) continue;
+            Point point;
+            double t;
+            if (impl::intersectFace(ray, rayNormal, *faces[i], -tolerance.edge, 1 + tolerance.edge, point, t)) {
+                closest.add(ray, faces[i], i, point, t, tolerance.includeOrigin);
             }
-        } else {
-            throw std::logic_error("Can get face intersection!");
         }
+        return closest.get(result);
     }
 
-    PointOnFacePtr findClosestIntersectionPoint(const Ray &ray, const std::vector<Face *> &faces) {
-
-        std::vector<PointOnFacePtr> intersections;
-        intersections.reserve(faces.size());
-        std::transform(
-                faces.begin(),
-                faces.end(),
-                std::back_inserter(intersections),
-                [&ray](const Face *face) { return findIntersectionPoint(ray, face); }
-        );
-        auto result = getClosest(intersections, ray.origin);
-
-        if (!result) {
-            intersections.clear();
-            std::transform(
-                    faces.begin(),
-                    faces.end(),
-                    std::back_inserter(intersections),
-                    [&ray](const Face *face) { return findIntersectionPoint(ray, face, true); }
-            );
-            result = getClosest(intersections, ray.origin);
-        }
-        return result;
+    PointOnFacePtr findClosestIntersectionPoint(const Ray &ray, ArrayView<Face *> faces) {
+        PointOnFace pointOnFace{};
+        if (!findExitPoint(ray, faces, nullptr, pointOnFace)) return nullptr;
+        return make_unique<PointOnFace>(pointOnFace);
     }
 
     tl::optional<Vector> calcDirection(
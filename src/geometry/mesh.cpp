@@ -5,15 +5,31 @@
 #include <stdexcept>
 
 namespace raytracer {
-    std::vector<Face *> MfemMesh::getBoundary() const {
+    template<typename T>
+    std::vector<T *> getPointers(const std::vector<std::unique_ptr<T>> &owners) {
+        std::vector<T *> result;
+        result.reserve(owners.size());
+        for (const auto &owner : owners) {
+            result.emplace_back(owner.get());
+        }
+        return result;
+    }
+
+    ArrayView<Face *> MfemMesh::getBoundary() const {
         return this->boundaryFaces;
     }
 
-    MfemMesh::MfemMesh(mfem::Mesh *mesh) : mesh(mesh) { this->init(); }
+    const BoundaryIndex &MfemMesh::getBoundaryIndex() const {
+        return this->boundaryIndex;
+    }
+
+    MfemMesh::MfemMesh(mfem::Mesh *mesh, unsigned threadsCount) :
+            mesh(mesh), threadsCount(threadsCount) { this->init(); }
 
-    MfemMesh::MfemMesh(const std::string &filename, bool generateEdges, bool refine) :
+    MfemMesh::MfemMesh(const std::string &filename, bool generateEdges, bool refine, unsigned threadsCount) :
             mfemMesh(make_unique<mfem::Mesh>(filename.c_str(), generateEdges, refine)),
-            mesh(mfemMesh.get()) {
+            mesh(mfemMesh.get()),
+            threadsCount(threadsCount) {
         this->init();
     }
 
@@ -47,6 +63,8 @@ namespace raytracer {
             point->x = coords[0];
             point->y = coords[1];
         }
+        this->boundaryIndex = BoundaryIndex(this->boundaryFaces);
+        this->facesUnitNormals = this->genFacesUnitNormals();
     }
 
     std::vector<Point *> MfemMesh::getPointsFromIds(const mfem::Array<int> &ids) const {
@@ -67,10 +85,8 @@ namespace raytracer {
 
     std::vector<Face *> MfemMesh::genBoundaryFaces() {
         std::vector<Face *> result;
-        for (int i = 0; i < this->mesh->GetNumFaces(); ++i) {
-            int id1, id2;
-            this->mesh->GetFaceElements(i, &id1, &id2);
-            if (id1 == -1 || id2 == -1) {
+        for (std::size_t i = 0; i < this->facesAdjElements.size(); ++i) {
+            if (!this->facesAdjElements[i].first || !this->facesAdjElements[i].second) {
                 result.emplace_back(this->faces[i].get());
             }
         }
@@ -82,6 +98,10 @@ namespace raytracer {
         else return this->elements[id].get();
     }
 
+    Face *MfemMesh::getFaceFromId(int id) const {
+        return this->faces[id].get();
+    }
+
     std::vector<std::unique_ptr<Point>> MfemMesh::genPoints() {
         std::vector<std::unique_ptr<Point>> result;
         result.reserve(mesh->GetNV());
@@ -92,9 +112,8 @@ namespace raytracer {
     }
 
     std::vector<std::unique_ptr<Face>> MfemMesh::genFaces() {
-        std::vector<std::unique_ptr<Face>> result;
         int facesCount = this->mesh->Dimension() == 2 ? this->mesh->GetNEdges() : this->mesh->GetNFaces();
-
+        std::vector<std::unique_ptr<Face>> result;
         result.reserve(facesCount);
         for (int id = 0; id < facesCount; ++id) {
             result.emplace_back(this->createFaceFromId(id));
@@ -104,7 +123,6 @@ namespace raytracer {
 
     std::vector<std::unique_ptr<Element>> MfemMesh::genElements() {
         std::vector<std::unique_ptr<Element>> result;
-
         result.reserve(mesh->GetNE());
         for (int id = 0; id < mesh->GetNE(); ++id) {
             result.emplace_back(this->createElementFromId(id));
@@ -123,10 +141,8 @@ namespace raytracer {
     }
 
     Element *MfemMesh::getFaceDirAdjElement(const Face *face, const Vector &direction) const {
-        auto adjacent = getFaceAdjElements(face);
-        auto normal = face->getNormal();
-
-        if (normal * direction < 0) {
+        const auto &adjacent = facesAdjElements[face->getId()];
+        if (facesUnitNormals[face->getId()] * direction < 0) {
             return adjacent.first;
         } else {
             return adjacent.second;
@@ -147,100 +163,98 @@ namespace raytracer {
     }
 
     void MfemMesh::setBoundaryAndInner() {
-        std::set<Point *> boundaryPointsSet;
+        std::vector<char> isBoundary(this->points.size(), false);
         for (const auto &face : this->boundaryFaces) {
             for (const auto &point : face->getPoints()) {
-                boundaryPointsSet.insert(point);
+                isBoundary[point->id] = true;
             }
         }
+        innerPoints.clear();
+        boundaryPoints.clear();
         for (const auto &point : this->points) {
-            if (boundaryPointsSet.find(point.get()) == boundaryPointsSet.end()) {
+            if (isBoundary[point->id]) {
+                boundaryPoints.emplace_back(point.get());
+            } else {
                 innerPoints.emplace_back(point.get());
             }
         }
-        boundaryPoints.assign(boundaryPointsSet.begin(), boundaryPointsSet.end());
     }
 
-    std::vector<Point *> MfemMesh::getInnerPoints() const {
+    ArrayView<Point *> MfemMesh::getInnerPoints() const {
         return this->innerPoints;
     }
 
-    std::vector<Point *> MfemMesh::getBoundaryPoints() const {
+    ArrayView<Point *> MfemMesh::getBoundaryPoints() const {
         return this->boundaryPoints;
     }
 
-    std::vector<Element *> MfemMesh::precalcPointAdjacentElements(const Point *point) const {
-        int pointId = -1;
-        for (uint i = 0; i < this->points.size(); i++) {
-            if (point == this->points[i].get()) {
-                pointId = i;
-                break;
-            }
-        }
-
-        mfem::Array<int> elementIds(
-                this->vertexToElementTable->GetRow(pointId),
-                this->vertexToElementTable->RowSize(pointId)
-        );
-        std::vector<Element *> result;
-        result.reserve(elementIds.Size());
-        for (auto id : elementIds) {
-            result.emplace_back(this->getElementFromId(id));
-        }
-        return result;
-    }
-
-    std::vector<Point *> MfemMesh::getPoints() const {
-        std::vector<Point *> result;
-        std::transform(this->points.begin(), this->points.end(), std::back_inserter(result), [](const std::unique_ptr<Point>& point) {
-            return point.get();
-        });
-        return result;
+    ArrayView<Point *> MfemMesh::getPoints() const {
+        return this->pointPointers;
     }
 
     mfem::Mesh *MfemMesh::getMfemMesh() const {
         return this->mesh;
     }
 
-    std::vector<Element *> MfemMesh::getElements() const {
-        std::vector<Element *> result;
-        std::transform(
-                this->elements.begin(), this->elements.end(), std::back_inserter(result),
-                [](const std::unique_ptr<Element>& element) {
-                    return element.get();
-                }
-        );
-        return result;
+    ArrayView<Element *> MfemMesh::getElements() const {
+        return this->elementPointers;
     }
 
     void MfemMesh::init() {
         this->elementToElementTable = mesh->ElementToElementTable();
-        this->vertexToElementTable = std::unique_ptr<mfem::Table>(mesh->GetVertexToElementTable());
         this->points = this->genPoints();
         this->faces = this->genFaces();
         this->elements = this->genElements();
+        this->pointPointers = getPointers(this->points);
+        this->elementPointers = getPointers(this->elements);
+        this->facesAdjElements = this->genFacesAdjElements();
+        this->facesUnitNormals = this->genFacesUnitNormals();
         this->boundaryFaces = this->genBoundaryFaces();
+        this->boundaryIndex = BoundaryIndex(this->boundaryFaces);
         this->setBoundaryAndInner();
-        this->pointsAdjacentElements = this->genPointsAdjacentElements();
+        this->setPointsAdjElements();
     }
 
-    std::map<const Point *, std::vector<Element *>> MfemMesh::genPointsAdjacentElements() const {
-        std::map<const Point *, std::vector<Element *>> result;
-        for (const Point *point: this->getPoints()) {
-            result[point] = precalcPointAdjacentElements(point);
-        }
-        return result;
+    void MfemMesh::setPointsAdjElements() {
+        std::unique_ptr<mfem::Table> vertexToElementTable(mesh->GetVertexToElementTable());
+        pointsAdjElementsOffsets.assign(vertexToElementTable->GetI(), vertexToElementTable->GetI() + points.size() + 1);
+        pointsAdjElements.resize(pointsAdjElementsOffsets.back());
+        const int *elementIds = vertexToElementTable->GetJ();
+        parallelFor(pointsAdjElements.size(), this->threadsCount, [this, elementIds](std::size_t i) {
+            pointsAdjElements[i] = this->getElementFromId(elementIds[i]);
+        });
     }
 
-    std::vector<Element *> MfemMesh::getPointAdjacentElements(const Point *point) const {
-        return pointsAdjacentElements.at(point);
+    ArrayView<Element *> MfemMesh::getPointAdjacentElements(const Point *point) const {
+        auto begin = pointsAdjElementsOffsets[point->id];
+        return {pointsAdjElements.data() + begin, pointsAdjElementsOffsets[point->id + 1] - begin};
     }
 
     std::pair<Element *, Element *> MfemMesh::getFaceAdjElements(const Face *face) const {
-        int elementA, elementB;
-        this->mesh->GetFaceElements(face->getId(), &elementA, &elementB);
+        return facesAdjElements[face->getId()];
+    }
 
-        return {getElementFromId(elementA), getElementFromId(elementB)};
+    const Vector &MfemMesh::getFaceUnitNormal(const Face *face) const {
+        return facesUnitNormals[face->getId()];
+    }
+
+    std::vector<std::pair<Element *, Element *>> MfemMesh::genFacesAdjElements() const {
+        std::vector<std::pair<Element *, Element *>> result(this->faces.size());
+        for (std::size_t id = 0; id < result.size(); ++id) {
+            int elementA, elementB;
+            this->mesh->GetFaceElements(static_cast<int>(id), &elementA, &elementB);
+            result[id] = {getElementFromId(elementA), getElementFromId(elementB)};
+        }
+        return result;
+    }
+
+    std::vector<Vector> MfemMesh::genFacesUnitNormals() const {
+        std::vector<Vector> result(this->faces.size());
+        parallelFor(result.size(), this->threadsCount, [this, &result](std::size_t id) {
+            auto normal = this->faces[id]->getNormal();
+            result[id] = 1 / normal.getNorm() * normal;
+        });
+        return result;
     }
 
     std::pair<Face *, Face *> MfemMesh::getSharedFaces(const Point *point, const Element &element) {
@@ -322,7 +336,8 @@ namespace raytracer {
     MfemMesh::MfemMesh(
             SegmentedLine sideA,
             SegmentedLine sideB,
-            mfem::Element::Type elementType
+            mfem::Element::Type elementType,
+            unsigned threadsCount
     ) : mfemMesh(make_unique<mfem::Mesh>(
             sideA.segmentCount,
             sideB.segmentCount,
@@ -331,7 +346,8 @@ namespace raytracer {
             sideA.end - sideA.start,
             sideB.end - sideB.start,
             true)),
-        mesh(mfemMesh.get()) {
+        mesh(mfemMesh.get()),
+        threadsCount(threadsCount) {
 
         auto nodesCount = mfemMesh->GetNV();
         Displacements displacements(nodesCount, {sideA.start, sideB.start});
@@ -368,8 +384,10 @@ namespace raytracer {
         const auto &points = mesh.getInnerPoints();
         stringstream elementsString;
         elementsString << "elements\n" << points.size() << "\n";
+        std::vector<Element *> adjacentElements;
         for (const Point *point : mesh.getInnerPoints()) {
-            auto adjacentElements = mesh.getPointAdjacentElements(point);
+            const auto adjacentElementsView = mesh.getPointAdjacentElements(point);
+            adjacentElements.assign(adjacentElementsView.begin(), adjacentElementsView.end());
             std::string elementPrefix;
             if (adjacentElements.size() == 3) {
                 elementPrefix = "1 2";
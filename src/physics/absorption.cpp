@@ -1,4 +1,6 @@
 #include "absorption.h"
+#include <algorithm>
+#include <cstdint>
 #include <stdexcept>
 #include <msgpack.hpp>
 
@@ -8,21 +10,49 @@ namespace raytracer {
     }
 
 
+    ModelPowersSets::ModelPowersSets(
+            std::vector<const PowerExchangeModel *> models,
+            std::vector<std::size_t> rayOffsets
+    ) : models(std::move(models)), rayOffsets(std::move(rayOffsets)) {
+        if (this->rayOffsets.empty() || this->rayOffsets.front() != 0 ||
+            !std::is_sorted(this->rayOffsets.begin(), this->rayOffsets.end())) {
+            throw std::logic_error("Ray offsets must ascend from zero!");
+        }
+        powers.assign(this->models.size() * getIntersectionsCount(), 0);
+    }
+
+    PowersSet ModelPowersSets::getPowersSet(std::size_t modelIndex) const {
+        const auto modelPowers = getPowers(modelIndex);
+        PowersSet result;
+        result.reserve(getRaysCount());
+        for (std::size_t rayIndex = 0; rayIndex < getRaysCount(); rayIndex++) {
+            Powers rayPowers;
+            rayPowers.reserve(getRayEnd(rayIndex) - getRayBegin(rayIndex));
+            for (auto index = getRayBegin(rayIndex); index < getRayEnd(rayIndex); index++) {
+                rayPowers.emplace_back(Power{modelPowers[index]});
+            }
+            result.emplace_back(std::move(rayPowers));
+        }
+        return result;
+    }
+
     ModelPowersSets PowerExchangeController::genPowers(
             const IntersectionSet &intersectionSet,
-            const Powers &initialPowers
+            const Powers &initialPowers,
+            unsigned threadsCount
     ) const {
-        ModelPowersSets result;
-
-        for (const auto &model : this->models) {
-            result[model] = PowersSet(intersectionSet.size());
-            for (size_t setIndex = 0; setIndex < intersectionSet.size(); setIndex++) {
-                const auto &intersections = intersectionSet[setIndex];
-                result[model][setIndex] = Powers(intersections.size(), Power{0});
-            }
+        std::vector<std::size_t> rayOffsets{0};
+        rayOffsets.reserve(intersectionSet.size() + 1);
+        for (const auto &intersections : intersectionSet) {
+            rayOffsets.emplace_back(rayOffsets.back() + intersections.size());
         }
-        for (size_t setIndex = 0; setIndex < intersectionSet.size(); setIndex++) {
+        ModelPowersSets result(this->models, std::move(rayOffsets));
+        const auto intersectionsCount = result.getIntersectionsCount();
+        double *powers = result.getPowers(0);
+
+        parallelFor(intersectionSet.size(), threadsCount, [&](size_t setIndex) {
             const auto &intersections = intersectionSet[setIndex];
+            auto begin = result.getRayBegin(setIndex);
             auto currentPower = initialPowers[setIndex].asDouble;
             for (size_t i = 0; i < intersections.size(); i++) {
                 const auto &intersection = intersections[i];
@@ -31,19 +61,148 @@ namespace raytracer {
                     prevIntersection = intersections[i - 1];
                 }
 
-                for (const auto &model : this->models) {
-                    auto absorbed = model->getPowerChange(
+                for (size_t modelIndex = 0; modelIndex < this->models.size(); modelIndex++) {
+                    auto absorbed = this->models[modelIndex]->getPowerChange(
                             prevIntersection,
                             intersection,
-                            Power{currentPower});
-                    currentPower -= absorbed.asDouble;
-                    result[model][setIndex][i] = absorbed;
+                            Power{currentPower}).asDouble;
+                    currentPower -= absorbed;
+                    powers[modelIndex * intersectionsCount + begin + i] = absorbed;
                 }
             }
+        });
+        return result;
+    }
+
+    ModelPowersSets PowerExchangeController::genPowers(
+            const FlatIntersectionSet &intersectionSet,
+            const Powers &initialPowers,
+            unsigned threadsCount
+    ) const {
+        std::vector<std::size_t> rayOffsets;
+        rayOffsets.reserve(intersectionSet.getRaysCount() + 1);
+        for (size_t setIndex = 0; setIndex < intersectionSet.getRaysCount(); setIndex++) {
+            rayOffsets.emplace_back(intersectionSet.getRayBegin(setIndex));
         }
+        rayOffsets.emplace_back(intersectionSet.getIntersectionsCount());
+        ModelPowersSets result(this->models, std::move(rayOffsets));
+        const auto intersectionsCount = result.getIntersectionsCount();
+        double *powers = result.getPowers(0);
+
+        parallelFor(intersectionSet.getRaysCount(), threadsCount, [&](size_t setIndex) {
+            auto begin = intersectionSet.getRayBegin(setIndex);
+            auto end = intersectionSet.getRayEnd(setIndex);
+            auto currentPower = initialPowers[setIndex].asDouble;
+            tl::optional<Intersection> prevIntersection;
+            for (size_t index = begin; index < end; index++) {
+                auto intersection = intersectionSet.getIntersection(setIndex, index);
+
+                for (size_t modelIndex = 0; modelIndex < this->models.size(); modelIndex++) {
+                    auto absorbed = this->models[modelIndex]->getPowerChange(
+                            prevIntersection,
+                            intersection,
+                            Power{currentPower}).asDouble;
+                    currentPower -= absorbed;
+                    powers[modelIndex * intersectionsCount + index] = absorbed;
+                }
+                prevIntersection = intersection;
+            }
+        });
         return result;
     }
 
+    PowerExchangeVisitor::PowerExchangeVisitor(
+            const PowerExchangeController &controller,
+            const Powers &initialPowers,
+            std::size_t elementsCount,
+            Powers *finalPowers,
+            FlatIntersectionSet *trajectory,
+            const StopAtPower *stopAtPower,
+            InterErrLog *errLog
+    ) :
+            models(controller.models),
+            initialPowers(initialPowers),
+            finalPowers(finalPowers),
+            trajectory(trajectory),
+            stopAtPower(stopAtPower),
+            errLog(errLog),
+            absorbedPowers(elementsCount, 0),
+            modelsPowers(controller.models.size(), 0) {}
+
+    bool PowerExchangeVisitor::onIntersection(
+            std::size_t rayIndex,
+            const Intersection *previous,
+            const Intersection &current
+    ) {
+        if (trajectory) trajectory->append(current);
+        if (!previous) {
+            currentPower = initialPowers[rayIndex].asDouble;
+            intersectionsCount = 0;
+        }
+
+        double exchanged = 0;
+        for (std::size_t i = 0; i < models.size(); ++i) {
+            auto power = models[i]->calcPowerChange(previous, current, currentPower);
+            currentPower -= power;
+            modelsPowers[i] += power;
+            exchanged += power;
+        }
+
+        // Power exchanged at the entry is deposited only if the ray ends there, same as in absorbRayPowers
+        if (intersectionsCount == 0) {
+            firstElement = current.nextElement;
+            firstExchanged = exchanged;
+        } else if (current.previousElement) {
+            absorbedPowers[current.previousElement->getId()] += exchanged;
+        }
+        ++intersectionsCount;
+
+        // Rays leaving the mesh end anyway
+        if (!stopAtPower || !previous || !current.nextElement) return true;
+        switch ((*stopAtPower)(currentPower, initialPowers[rayIndex].asDouble, current.pointOnFace.id)) {
+            case PowerFate::Keep:
+                return true;
+            case PowerFate::Survived:
+                if (errLog) errLog->rouletteSurvived++;
+                return true;
+            case PowerFate::CutOff:
+                if (errLog) errLog->powerCutOff++;
+                absorbedPowers[current.nextElement->getId()] += currentPower;
+                cutOffPower += currentPower;
+                currentPower = 0;
+                return false;
+            case PowerFate::Killed:
+                if (errLog) errLog->rouletteKilled++;
+                currentPower = 0;
+                return false;
+        }
+        return true;
+    }
+
+    void PowerExchangeVisitor::onRayEnd(std::size_t rayIndex) {
+        if (intersectionsCount == 1 && firstElement) {
+            absorbedPowers[firstElement->getId()] += firstExchanged;
+        }
+        if (finalPowers) (*finalPowers)[rayIndex] = Power{currentPower};
+        if (trajectory) trajectory->endRay();
+    }
+
+    const std::vector<double> &PowerExchangeVisitor::getAbsorbedPowers() const {
+        return absorbedPowers;
+    }
+
+    std::vector<double> PowerExchangeVisitor::releaseAbsorbedPowers() {
+        return std::move(absorbedPowers);
+    }
+
+    const std::vector<double> &PowerExchangeVisitor::getModelsPowers() const {
+        return modelsPowers;
+    }
+
+    double PowerExchangeVisitor::getCutOffPower() const {
+        return cutOffPower;
+    }
+
     size_t PowerExchangeController::getModelsCount() const {
         return this->models.size();
     }
@@ -51,14 +210,20 @@ namespace raytracer {
     Power Resonance::getPowerChange(const tl::optional<Intersection> &,
                                     const Intersection &currentIntersection,
                                     const Power &currentPower) const {
-        if (!Resonance::isResonating(currentIntersection.pointOnFace)) return Power{0};
+        return Power{calcPowerChange(nullptr, currentIntersection, currentPower.asDouble)};
+    }
+
+    double Resonance::calcPowerChange(const Intersection *,
+                                      const Intersection &currentIntersection,
+                                      double currentPower) const {
+        if (!Resonance::isResonating(currentIntersection.pointOnFace)) return 0;
         auto grad = gradCalc->get(currentIntersection.pointOnFace);
-        if (!grad) return Power{0};
+        if (!grad) return 0;
 
         auto dir = currentIntersection.direction;
         auto q = Resonance::getQ(dir, grad.value());
         auto term = q * std::exp(-4.0 / 3.0 * std::pow(q, 3.0 / 2.0)) / (q + 0.48) * M_PI / 2.0;
-        return Power{currentPower.asDouble * term};
+        return currentPower * term;
     }
 
     bool Resonance::isResonating(const PointOnFace &pointOnFace) const {
@@ -107,35 +272,35 @@ namespace raytracer {
     }
 
     PowersSet modelPowersToRayPowers(const ModelPowersSets &modelPowersSets, const Powers &initialPowers) {
-        auto setsCount = modelPowersSets.begin()->second.size();
-        PowersSet result;
-        result.reserve(setsCount);
-
-        const auto &firstPowersSets = modelPowersSets.begin()->second;
-        for (const auto &powers : firstPowersSets) {
-            result.emplace_back(Powers(powers.size(), Power{0}));
-        }
-        for (const auto &oneModelPowersSets : modelPowersSets) {
-            const auto &powersSets = oneModelPowersSets.second;
-            for (size_t setIndex = 0; setIndex < setsCount; setIndex++) {
-                const auto &powers = powersSets[setIndex];
-                for (size_t i = 0; i < powers.size(); i++) {
-                    result[setIndex][i].asDouble += powers[i].asDouble;
-                }
+        const auto intersectionsCount = modelPowersSets.getIntersectionsCount();
+        std::vector<double> exchanged(intersectionsCount, 0);
+        for (size_t modelIndex = 0; modelIndex < modelPowersSets.getModelsCount(); modelIndex++) {
+            const double *powers = modelPowersSets.getPowers(modelIndex);
+            for (size_t index = 0; index < intersectionsCount; index++) {
+                exchanged[index] += powers[index];
             }
         }
 
-        for (size_t setIndex = 0; setIndex < setsCount; setIndex++) {
-            auto &powers = result[setIndex];
-            double currentPower = initialPowers[setIndex].asDouble;
-            if (powers.size() > 1) {
-                for (auto &power : powers) {
-                    currentPower -= power.asDouble;
-                    power = Power{currentPower};
+        PowersSet result;
+        result.reserve(modelPowersSets.getRaysCount());
+        for (size_t setIndex = 0; setIndex < modelPowersSets.getRaysCount(); setIndex++) {
+            auto begin = modelPowersSets.getRayBegin(setIndex);
+            auto end = modelPowersSets.getRayEnd(setIndex);
+            Powers powers;
+            powers.reserve(end - begin);
+            if (end - begin > 1) {
+                double currentPower = initialPowers[setIndex].asDouble;
+                for (auto index = begin; index < end; index++) {
+                    currentPower -= exchanged[index];
+                    powers.emplace_back(Power{currentPower});
+                }
+            } else {
+                for (auto index = begin; index < end; index++) {
+                    powers.emplace_back(Power{exchanged[index]});
                 }
             }
+            result.emplace_back(std::move(powers));
         }
-
         return result;
     }
 
@@ -154,14 +319,26 @@ namespace raytracer {
     }
 
     std::ostream &modelPowersToMsgpack(const ModelPowersSets &modelPowersSets, std::ostream &os) {
-        std::map<std::string, std::vector<std::vector<double>>> powersSerialization;
-        for (const auto &oneModelPowersSet : modelPowersSets) {
-            auto modelName = oneModelPowersSet.first->getName();
-            auto powersSet = oneModelPowersSet.second;
-
-            powersSerialization[modelName] = genSetSerialization(powersSet);
+        // Packed as a map of model names to [ray index][intersection index] arrays, a later model wins a shared name
+        std::map<std::string, std::size_t> modelIndices;
+        for (size_t modelIndex = 0; modelIndex < modelPowersSets.getModelsCount(); modelIndex++) {
+            modelIndices[modelPowersSets.getModel(modelIndex)->getName()] = modelIndex;
+        }
+        msgpack::packer<std::ostream> packer(os);
+        packer.pack_map(static_cast<std::uint32_t>(modelIndices.size()));
+        for (const auto &modelIndex : modelIndices) {
+            packer.pack(modelIndex.first);
+            const double *powers = modelPowersSets.getPowers(modelIndex.second);
+            packer.pack_array(static_cast<std::uint32_t>(modelPowersSets.getRaysCount()));
+            for (size_t setIndex = 0; setIndex < modelPowersSets.getRaysCount(); setIndex++) {
+                auto begin = modelPowersSets.getRayBegin(setIndex);
+                auto end = modelPowersSets.getRayEnd(setIndex);
+                packer.pack_array(static_cast<std::uint32_t>(end - begin));
+                for (auto index = begin; index < end; index++) {
+                    packer.pack_double(powers[index]);
+                }
+            }
         }
-        msgpack::pack(os, powersSerialization);
         return os;
     }
 
@@ -170,25 +347,66 @@ namespace raytracer {
         return os;
     }
 
-    std::vector<double>
-    absorbRayPowers(std::size_t elementsCount, const PowersSet &powersSets, const IntersectionSet &intersectionSet) {
-        std::vector<double> absorbedPower(elementsCount, 0);
-        for (size_t setIndex = 0; setIndex < intersectionSet.size(); setIndex++) {
+    std::vector<double> absorbRayPowers(
+            std::size_t elementsCount,
+            const PowersSet &powersSets,
+            const IntersectionSet &intersectionSet,
+            unsigned threadsCount
+    ) {
+        std::vector<std::size_t> offsets{0};
+        offsets.reserve(intersectionSet.size() + 1);
+        for (const auto &intersections : intersectionSet) {
+            offsets.emplace_back(offsets.back() + intersections.size());
+        }
+        // Each intersection deposits at most once, so the deposits are laid out flat and reduced afterwards
+        std::vector<std::int32_t> elementIds(offsets.back(), -1);
+        std::vector<double> deposits(offsets.back(), 0);
+        parallelFor(intersectionSet.size(), threadsCount, [&](size_t setIndex) {
             const auto &powers = powersSets[setIndex];
             const auto &intersections = intersectionSet[setIndex];
+            auto begin = offsets[setIndex];
+            // A ray that missed the mesh has no slot to write to
+            if (intersections.empty()) return;
             if (intersections.size() > 1) {
                 for (size_t i = 1; i < intersections.size(); i++) {
                     auto element = intersections[i].previousElement;
                     if (!element) continue;
-                    const auto &absorbed = -(powers[i].asDouble - powers[i - 1].asDouble);
-                    absorbedPower[element->getId()] += absorbed;
+                    elementIds[begin + i] = element->getId();
+                    deposits[begin + i] = -(powers[i].asDouble - powers[i - 1].asDouble);
+                }
+            } else if (intersections[0].nextElement) {
+                elementIds[begin] = intersections[0].nextElement->getId();
+                deposits[begin] = powers[0].asDouble;
+            }
+        });
+        return parallelScatterAdd(elementIds, deposits, elementsCount, threadsCount);
+    }
+
+    std::vector<double> absorbRayPowers(
+            std::size_t elementsCount,
+            const PowersSet &powersSets,
+            const FlatIntersectionSet &intersectionSet,
+            unsigned threadsCount
+    ) {
+        std::vector<std::int32_t> elementIds(intersectionSet.getIntersectionsCount(), -1);
+        std::vector<double> deposits(intersectionSet.getIntersectionsCount(), 0);
+        parallelFor(intersectionSet.getRaysCount(), threadsCount, [&](size_t setIndex) {
+            const auto &powers = powersSets[setIndex];
+            auto begin = intersectionSet.getRayBegin(setIndex);
+            auto end = intersectionSet.getRayEnd(setIndex);
+            // A ray that missed the mesh has no slot to write to
+            if (end == begin) return;
+            if (end - begin > 1) {
+                for (size_t index = begin + 1; index < end; index++) {
+                    auto i = index - begin;
+                    elementIds[index] = intersectionSet.getPreviousElementId(index);
+                    deposits[index] = -(powers[i].asDouble - powers[i - 1].asDouble);
                 }
             } else {
-                auto element = intersections[0].nextElement;
-                absorbedPower[element->getId()] += powers[0].asDouble;
+                elementIds[begin] = intersectionSet.getNextElementId(begin);
+                deposits[begin] = powers[0].asDouble;
             }
-        }
-        return absorbedPower;
+        });
+        return parallelScatterAdd(elementIds, deposits, elementsCount, threadsCount);
     }
 }
-
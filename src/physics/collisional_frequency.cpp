@@ -28,6 +28,52 @@ namespace raytracer {
         return result;
     }
 
+    std::vector<double> calcSpitzerFreqs(
+            ArrayView<double> dens,
+            ArrayView<double> temp,
+            ArrayView<double> ioni,
+            Length wavelen,
+            unsigned threadsCount
+    ) {
+        using namespace boost::math;
+        if (dens.size() != temp.size() || dens.size() != ioni.size()) {
+            throw std::logic_error("Density, temperature and ionization must have the same size!");
+        }
+
+        auto e = constants::electron_charge;
+        auto m_e = constants::electron_mass;
+        auto k_b = constants::boltzmann_constant;
+        auto h = constants::reduced_planck_constant;
+        const double omega = 2 * M_PI * constants::speed_of_light / wavelen.asDouble;
+        const double fermiFactor = h * h / (2 * m_e);
+        const double fermiDensFactor = pow<2>(3 * M_PI * M_PI);
+        const double plasmaFactor = 4 * M_PI * e * e / m_e;
+        const double spitzerFactor = 4.0 / 3.0 * std::sqrt(2 * M_PI) * pow<4>(e) / std::sqrt(m_e);
+        const double e2 = e * e;
+
+        std::vector<double> result(dens.size());
+        const double *n = dens.data();
+        const double *T = temp.data();
+        const double *Z = ioni.data();
+        double *freq = result.data();
+        parallelForRanges(result.size(), threadsCount, [&](std::size_t begin, std::size_t end, unsigned) {
+            for (auto i = begin; i < end; ++i) {
+                const double kT = k_b * T[i];
+                const double thermalVelocity = std::sqrt(kT / m_e);
+                const double b_max = thermalVelocity / std::max(omega, std::sqrt(plasmaFactor * n[i]));
+                const double b_min = std::max(Z[i] * e2 / kT, h / thermalVelocity);
+                const double ln_lamb = std::max(2.0, 0.5 * std::log(std::abs(b_max) / std::abs(b_min)));
+                const double E_F = fermiFactor * std::cbrt(fermiDensFactor * n[i] * n[i]);
+                const double energy = kT + E_F;
+                freq[i] = spitzerFactor * Z[i] * n[i] / (energy * std::sqrt(energy)) * ln_lamb;
+            }
+        });
+        for (auto value : result) {
+            if (std::isnan(value)) throw std::logic_error("Nan collisional frequency!");
+        }
+        return result;
+    }
+
     namespace impl {
         double calcCoulombLog(double dens, double temp, double ioni, Length wavelen) {
             auto n_e = dens;
@@ -1,5 +1,8 @@
 #include "gradient.h"
 #include <msgpack.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <stdexcept>
 
 namespace raytracer {
@@ -17,6 +20,40 @@ namespace raytracer {
             x.forward_substitute(R, Qtb);
             return {x(1, 0), x(2, 0)};
         }
+
+        ArrayView<Element *> getHousStencil(const Mesh &mesh, const Point *point, std::vector<Element *> &buffer) {
+            auto elements = mesh.getPointAdjacentElements(point);
+            if (elements.size() < 3) {
+                buffer = {elements[0]};
+                auto adjacent = mesh.getElementAdjacentElements(*elements[0]);
+                buffer.insert(buffer.end(), adjacent.begin(), adjacent.end());
+                buffer.emplace_back(nullptr);
+                elements = buffer;
+            }
+            return elements;
+        }
+
+        double getHousRow(
+                const Point *point,
+                const Element *element,
+                const Element &firstElement,
+                std::array<double, 3> &row
+        ) {
+            Point centroid;
+            if (!element) {
+                auto elementCentroid = getElementCentroid(firstElement);
+                centroid = Point(Vector(*point) + (*point - elementCentroid));
+            } else {
+                centroid = getElementCentroid(*element);
+            }
+
+            auto dx = centroid.x - point->x;
+            auto dy = centroid.y - point->y;
+            auto d = dx * dx + dy * dy;
+            auto weight = 1 / std::pow(d, 0.125);
+            row = {{weight, weight * dx, weight * dy}};
+            return weight;
+        }
     }
 
     ConstantGradient::ConstantGradient(const Vector &gradient) : gradient(gradient) {}
@@ -41,7 +78,7 @@ namespace raytracer {
         VectorField gfToField(const MfemMesh &mesh, const mfem::GridFunction &function) {
             auto dimSize = function.Size() / function.VectorDim();
 
-            VectorField result;
+            VectorField result(mesh.getPoints().size());
             const auto &points = mesh.getInnerPoints();
             for (Point *point : points) {
                 result[point] = Vector{function[point->id], function[dimSize + point->id]};
@@ -69,14 +106,90 @@ namespace raytracer {
         }
     }
 
+    MfemGradientSolver::MfemGradientSolver(
+            const MfemMesh &mesh,
+            mfem::FiniteElementSpace *l2Space,
+            mfem::VectorCoefficient *vectorBoundaryValue,
+            double diffusionC,
+            double meshH,
+            Preconditioner preconditioner
+    ) :
+            mesh(mesh),
+            vectorBoundaryValue(vectorBoundaryValue),
+            h1Fec(1, mesh.getMfemMesh()->Dimension()),
+            h1Space(mesh.getMfemMesh(), &h1Fec, mesh.getMfemMesh()->Dimension()),
+            bdrMarker(impl::allBdrMarker(*mesh.getMfemMesh())),
+            essTrueDofs(impl::getEssTrueDofs(bdrMarker, h1Space)),
+            diffusionCoefficient(diffusionC * meshH * meshH),
+            rightSide(&h1Space, l2Space),
+            leftSide(&h1Space),
+            rightSideVector(&h1Space),
+            solution(&h1Space) {
+        rightSide.AddDomainIntegrator(new mfem::VectorDivergenceIntegrator(divergenceCoefficient));
+        leftSide.AddDomainIntegrator(new mfem::VectorMassIntegrator);
+        if (diffusionC != 0) {
+            leftSide.AddDomainIntegrator(new mfem::VectorDiffusionIntegrator(diffusionCoefficient));
+        }
+
+        if (preconditioner == Preconditioner::Jacobi) {
+            this->preconditioner = make_unique<mfem::DSmoother>();
+        } else {
+            this->preconditioner = make_unique<mfem::GSSmoother>();
+        }
+        // The tolerance is set in solve relative to the right side, the iterations limit is the one of mfem::PCG
+        solver.SetRelTol(0);
+        solver.SetMaxIter(1000);
+        solver.SetPrintLevel(0);
+        solver.SetPreconditioner(*this->preconditioner);
+        solver.iterative_mode = true;
+
+        solution = 0;
+        this->update();
+    }
+
+    void MfemGradientSolver::update() {
+        if (vectorBoundaryValue) {
+            solution.ProjectBdrCoefficient(*vectorBoundaryValue, bdrMarker);
+        }
+        rightSide.Update();
+        rightSide.Assemble();
+        rightSide.Finalize();
+        leftSide.Update();
+        leftSide.Assemble();
+        leftSide.Finalize();
+        isOperatorSet = false;
+    }
+
+    VectorField MfemGradientSolver::solve(const mfem::GridFunction &rho) {
+        rightSide.MultTranspose(rho, rightSideVector);
+        // The boundary conditions are eliminated from the matrix only the first time after assembly,
+        // later only the right side is modified. The interior of the previous solution is kept as the initial guess.
+        leftSide.FormLinearSystem(essTrueDofs, solution, rightSideVector, A, X, B, 1);
+        if (!isOperatorSet) {
+            solver.SetOperator(A);
+            isOperatorSet = true;
+        }
+        // CGSolver measures the relative tolerance against the initial residual, which is already small
+        // when starting from the previous solution. Stop instead at the residual mfem::PCG would stop at
+        // starting from zero, i.e. 1e-6 of the preconditioned norm of B.
+        preconditionedB.SetSize(B.Size());
+        preconditioner->Mult(B, preconditionedB);
+        solver.SetAbsTol(std::max(1e-6 * std::sqrt(std::max(B * preconditionedB, 0.0)), 1e-12));
+        solver.Mult(B, X);
+        leftSide.RecoverFEMSolution(X, rightSideVector, solution);
+        return impl::gfToField(mesh, solution);
+    }
+
+    int MfemGradientSolver::getLastIterationsCount() const {
+        return solver.GetNumIterations();
+    }
+
     tl::optional<Vector> LinInterGrad::get(const PointOnFace &pointOnFace) const {
-        auto points = pointOnFace.face->getPoints();
-        auto it0 = this->gradientAtPoints.find(points[0]);
-        auto it1 = this->gradientAtPoints.find(points[1]);
-        if (it0 != this->gradientAtPoints.end() && it1 != this->gradientAtPoints.end()) {
-            auto gradient0 = it0->second;
-            auto gradient1 = it1->second;
-            return linearInterpolate(*points[0], *points[1], pointOnFace.point, gradient0, gradient1);
+        const auto &points = pointOnFace.face->getPoints();
+        auto gradient0 = this->gradientAtPoints.find(points[0]);
+        auto gradient1 = this->gradientAtPoints.find(points[1]);
+        if (gradient0 && gradient1) {
+            return linearInterpolate(*points[0], *points[1], pointOnFace.point, *gradient0, *gradient1);
         } else {
             return {};
         }
@@ -90,6 +203,64 @@ namespace raytracer {
         return valueA + factor * (valueB - valueA);
     }
 
+    namespace impl {
+        int generateFaceInterGradId() {
+            static std::atomic<int> counter{0};
+            return counter++;
+        }
+    }
+
+    FaceInterGrad::FaceInterGrad(const Mesh &mesh, const VectorField &gradientAtPoints) :
+            id(impl::generateFaceInterGradId()) {
+        for (const auto element : mesh.getElements()) {
+            for (const auto face : element->getFaces()) {
+                auto faceId = static_cast<std::size_t>(face->getId());
+                if (faceId >= faces.size()) faces.resize(faceId + 1);
+                auto &data = faces[faceId];
+                if (data.isValid) continue;
+
+                const auto &points = face->getPoints();
+                auto gradient0 = gradientAtPoints.find(points[0]);
+                auto gradient1 = gradientAtPoints.find(points[1]);
+                if (!gradient0 || !gradient1) continue;
+                data.startX = points[0]->x;
+                data.startY = points[0]->y;
+                data.invLength = 1 / (*points[1] - *points[0]).getNorm();
+                data.startGradient = *gradient0;
+                data.gradientChange = *gradient1 - *gradient0;
+                data.isValid = true;
+            }
+        }
+    }
+
+    tl::optional<Vector> FaceInterGrad::get(const PointOnFace &pointOnFace) const {
+        struct LastCrossing {
+            int ownerId{-1};
+            const Face *face{};
+            Point point{};
+            tl::optional<Vector> gradient{};
+        };
+        static thread_local LastCrossing last;
+        if (last.ownerId == id && last.face == pointOnFace.face &&
+            last.point.x == pointOnFace.point.x && last.point.y == pointOnFace.point.y) {
+            return last.gradient;
+        }
+
+        tl::optional<Vector> result;
+        const auto &data = faces[pointOnFace.face->getId()];
+        if (data.isValid) {
+            auto dx = pointOnFace.point.x - data.startX;
+            auto dy = pointOnFace.point.y - data.startY;
+            auto factor = std::sqrt(dx * dx + dy * dy) * data.invLength;
+            result = data.startGradient + factor * data.gradientChange;
+        }
+        last.ownerId = id;
+        last.face = pointOnFace.face;
+        last.point = pointOnFace.point;
+        last.gradient = result;
+        return result;
+    }
+
     bool impl::isQuadMesh(const Mesh &mesh) {
         return mesh.getElements()[0]->getPoints().size() == 4;
     }
@@ -100,27 +271,21 @@ namespace raytracer {
 
     std::ostream &operator<<(std::ostream &os, const VectorField &vectorField) {
         using namespace std;
-        vector<pair<Point *, Vector>> pairs(begin(vectorField), end(vectorField));
-        sort(begin(pairs), end(pairs), [](pair<Point *, Vector> pairA, pair<Point *, Vector> pairB) {
-            return pairA.first->id < pairB.first->id;
-        });
         vector<vector<double>> gradSerialization;
-        gradSerialization.reserve(pairs.size());
-        for (auto pair : pairs) {
-            gradSerialization.emplace_back(vector<double>{pair.first->x, pair.first->y, pair.second.x, pair.second.y});
+        for (size_t id = 0; id < vectorField.getSlotsCount(); ++id) {
+            const Point *point = vectorField.getPoint(id);
+            if (!point) continue;
+            const auto &value = vectorField.getValue(id);
+            gradSerialization.emplace_back(vector<double>{point->x, point->y, value.x, value.y});
         }
         msgpack::pack(os, gradSerialization);
         return os;
     }
 
-    VectorField setValue(const VectorField &grad, const std::vector<Point *> &points, const Vector &value) {
+    VectorField setValue(const VectorField &grad, ArrayView<Point *> points, const Vector &value) {
         auto result = grad;
         for (Point *point : points) {
-            if (grad.count(point)) {
-                result.at(point) = value;
-            } else {
-                result[point] = value;
-            }
+            result[point] = value;
         }
         return result;
     }
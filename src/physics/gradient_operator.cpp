@@ -0,0 +1,91 @@
+#include "gradient_operator.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace raytracer {
+    void GradientOperator::addRow(Point *point) {
+        rowPoints.emplace_back(point);
+        rowOffsets.emplace_back(rowOffsets.back());
+        slotsCount = std::max(slotsCount, static_cast<std::size_t>(point->id) + 1);
+    }
+
+    void GradientOperator::addEntry(int elementId, const Vector &weight) {
+        if (rowPoints.empty()) throw std::logic_error("Add a row before adding its entries!");
+        columns.emplace_back(elementId);
+        weightsX.emplace_back(weight.x);
+        weightsY.emplace_back(weight.y);
+        ++rowOffsets.back();
+    }
+
+    namespace impl {
+        void addHousGradRow(GradientOperator &result, const Mesh &mesh, Point *point) {
+            std::vector<Element *> buffer;
+            auto elements = getHousStencil(mesh, point, buffer);
+            auto rowsCount = static_cast<int>(elements.size());
+
+            rosetta::Matrix A(rowsCount, 3);
+            std::vector<double> rowWeights(elements.size());
+            std::array<double, 3> row{};
+            for (int index = 0; index < rowsCount; ++index) {
+                rowWeights[index] = getHousRow(point, elements[index], *elements[0], row);
+                for (int i = 0; i < 3; ++i) A(index, i) = row[i];
+            }
+            rosetta::Matrix Q, R;
+            householder(A, R, Q);
+            Q.trim_columns(3);
+            R.trim_rows(3);
+            Q.transpose();
+
+            // Column j of R^-1 Q^T maps the j-th weighted value to the fitted coefficients
+            result.addRow(point);
+            rosetta::Matrix column(3, 1);
+            rosetta::Matrix x(3, 1);
+            for (int index = 0; index < rowsCount; ++index) {
+                // The mirrored element has zero value and does not contribute
+                if (!elements[index]) continue;
+                for (int i = 0; i < 3; ++i) column(i, 0) = Q(i, index);
+                x.forward_substitute(R, column);
+                result.addEntry(
+                        elements[index]->getId(),
+                        Vector{x(1, 0) * rowWeights[index], x(2, 0) * rowWeights[index]}
+                );
+            }
+        }
+    }
+
+    GradientOperator assembleHousGradOperator(const Mesh &mesh, bool includeBorder) {
+        GradientOperator result;
+        for (const auto &point : includeBorder ? mesh.getPoints() : mesh.getInnerPoints()) {
+            impl::addHousGradRow(result, mesh, point);
+        }
+        return result;
+    }
+
+    GradientOperator assembleIntegralGradOperator(const Mesh &mesh) {
+        if (!impl::isQuadMesh(mesh)) throw std::logic_error("Integral grad is only available for quads");
+
+        GradientOperator result;
+        for (Point *point : mesh.getInnerPoints()) {
+            const auto &elements = mesh.getPointAdjOrderedElements(point);
+            const auto &points = mesh.getPointAdjOrderedPoints(point);
+
+            double volume = 0;
+            for (size_t i = 0; i < elements.size(); i++) {
+                auto nextI = i == elements.size() - 1 ? 0 : i + 1;
+                volume += impl::calcTriangleArea(*point, *points[i], *points[nextI]);
+            }
+
+            result.addRow(point);
+            for (size_t i = 0; i < elements.size(); i++) {
+                auto nextI = i == elements.size() - 1 ? 0 : i + 1;
+                auto adjPoint = points[i];
+                auto nextAdjPoint = points[nextI];
+                result.addEntry(
+                        elements[i]->getId(),
+                        Vector{(nextAdjPoint->y - adjPoint->y) / volume, -(nextAdjPoint->x - adjPoint->x) / volume}
+                );
+            }
+        }
+        return result;
+    }
+}
@@ -9,19 +9,15 @@ namespace raytracer {
             const Vector &entryDirection,
             const Element &element
     ) {
-        const auto &faces = element.getFaces();
-        std::vector<Face *> facesToSearch;
-        facesToSearch.reserve(faces.size());
-        std::copy_if(faces.begin(), faces.end(), std::back_inserter(facesToSearch),
-                     [&entryPointOnFace](const Face* face) {
-                         return entryPointOnFace.face != face;
-                     });
-        auto newPointOnFace = findClosestIntersectionPoint(
+        PointOnFace newPointOnFace{};
+        bool found = findExitPoint(
                 {entryPointOnFace.point, entryDirection},
-                facesToSearch
+                element.getFaces(),
+                entryPointOnFace.face,
+                newPointOnFace
         );
-        if (!newPointOnFace) throw std::logic_error("No intersection found, but it should definitely exist!");
-        return *newPointOnFace;
+        if (!found) throw std::logic_error("No intersection found, but it should definitely exist!");
+        return newPointOnFace;
     }
 
 }
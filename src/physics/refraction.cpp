@@ -54,16 +54,89 @@ namespace raytracer {
         return {constant * std::pow(wavelength.asDouble, -2)};
     }
 
+    constexpr std::size_t Marker::raysPerChunk;
+    constexpr std::size_t Marker::segmentsCount;
+
+    Marker::Marker() {
+        for (auto &segment : segments) segment.store(nullptr, std::memory_order_relaxed);
+    }
+
+    Marker::~Marker() {
+        for (std::size_t segmentIndex = 0; segmentIndex < segmentsCount; ++segmentIndex) {
+            auto segment = segments[segmentIndex].load(std::memory_order_relaxed);
+            if (!segment) continue;
+            for (std::size_t i = 0; i < (std::size_t{1} << segmentIndex); ++i) {
+                delete segment[i].load(std::memory_order_relaxed);
+            }
+            delete[] segment;
+        }
+    }
+
+    std::size_t Marker::getSegmentIndex(std::size_t chunkIndex) {
+        std::size_t segmentIndex = 0;
+        for (auto n = (chunkIndex + 1) >> 1; n > 0; n >>= 1) ++segmentIndex;
+        return segmentIndex;
+    }
+
+    std::vector<std::uint64_t> *Marker::findRay(std::size_t rayIndex) const {
+        auto chunkIndex = rayIndex / raysPerChunk;
+        auto segmentIndex = getSegmentIndex(chunkIndex);
+        auto segment = segments[segmentIndex].load(std::memory_order_acquire);
+        if (!segment) return nullptr;
+        auto chunk = segment[chunkIndex + 1 - (std::size_t{1} << segmentIndex)].load(std::memory_order_acquire);
+        return chunk ? &chunk->rays[rayIndex % raysPerChunk] : nullptr;
+    }
+
+    std::vector<std::uint64_t> &Marker::getRay(std::size_t rayIndex) {
+        auto chunkIndex = rayIndex / raysPerChunk;
+        auto segmentIndex = getSegmentIndex(chunkIndex);
+        auto segmentSize = std::size_t{1} << segmentIndex;
+        // Another thread may publish the segment or the chunk meanwhile, the first one wins
+        auto segment = segments[segmentIndex].load(std::memory_order_acquire);
+        if (!segment) {
+            auto newSegment = new Segment[segmentSize];
+            for (std::size_t i = 0; i < segmentSize; ++i) newSegment[i].store(nullptr, std::memory_order_relaxed);
+            if (segments[segmentIndex].compare_exchange_strong(segment, newSegment, std::memory_order_acq_rel)) {
+                segment = newSegment;
+            } else {
+                delete[] newSegment;
+            }
+        }
+        auto &slot = segment[chunkIndex + 1 - segmentSize];
+        auto chunk = slot.load(std::memory_order_acquire);
+        if (!chunk) {
+            auto newChunk = new Chunk;
+            if (slot.compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel)) {
+                chunk = newChunk;
+            } else {
+                delete newChunk;
+            }
+        }
+        return chunk->rays[rayIndex % raysPerChunk];
+    }
+
     void Marker::mark(const PointOnFace &pointOnFace) {
-        marked.insert(pointOnFace.id);
+        if (pointOnFace.id < 0) throw std::logic_error("Only crossings with valid id can be marked!");
+        auto &ray = getRay(getCrossingRayIndex(pointOnFace.id));
+        auto crossingIndex = getCrossingIndex(pointOnFace.id);
+        if (crossingIndex / 64 >= ray.size()) ray.resize(crossingIndex / 64 + 1, 0);
+        ray[crossingIndex / 64] |= std::uint64_t{1} << (crossingIndex % 64);
     }
 
     void Marker::unmark(const PointOnFace &pointOnFace) {
-        marked.erase(pointOnFace.id);
+        if (pointOnFace.id < 0) return;
+        auto ray = findRay(getCrossingRayIndex(pointOnFace.id));
+        auto crossingIndex = getCrossingIndex(pointOnFace.id);
+        if (!ray || crossingIndex / 64 >= ray->size()) return;
+        (*ray)[crossingIndex / 64] &= ~(std::uint64_t{1} << (crossingIndex % 64));
     }
 
     bool Marker::isMarked(const PointOnFace &pointOnFace) const {
-        return marked.find(pointOnFace.id) != marked.end();
+        if (pointOnFace.id < 0) return false;
+        auto ray = findRay(getCrossingRayIndex(pointOnFace.id));
+        auto crossingIndex = getCrossingIndex(pointOnFace.id);
+        if (!ray || crossingIndex / 64 >= ray->size()) return false;
+        return ((*ray)[crossingIndex / 64] >> (crossingIndex % 64)) & 1;
     }
 
     tl::optional<Vector>
@@ -71,6 +144,10 @@ namespace raytracer {
         return previousDirection;
     }
 
+    tl::optional<Vector> ContinueStraight::operator()(const CrossingContext &context) {
+        return context.direction;
+    }
+
     double calcRefractIndex(double density, const Length &wavelength, double collFreq) {
         auto permittivity = impl::calcPermittivity(density, wavelength, collFreq);
         if (permittivity.real() < 0) return 0;
@@ -97,4 +174,80 @@ namespace raytracer {
         auto eps = impl::calcPermittivity(density, wavelength, collFreq);
         return 4 * M_PI / wavelength.asDouble * std::sqrt(eps).imag();
     }
-}
\ No newline at end of file
+
+    namespace impl {
+        /**
+         * Fill result with the real or imaginary part of the square root of the permittivity
+         * for all the densities and frequencies given.
+         */
+        template<typename Part>
+        std::vector<double> calcPermittivityRoots(
+                ArrayView<double> density,
+                const Length &wavelength,
+                ArrayView<double> collFreq,
+                unsigned threadsCount,
+                Part part
+        ) {
+            if (density.size() != collFreq.size()) {
+                throw std::logic_error("Density and collisional frequency must have the same size!");
+            }
+            auto e = constants::electron_charge;
+            auto m_e = constants::electron_mass;
+            const double omega = 2 * M_PI * constants::speed_of_light / wavelength.asDouble;
+            const double omega2 = omega * omega;
+            const double plasmaFactor = 4 * M_PI * e * e / m_e;
+
+            std::vector<double> result(density.size());
+            const double *n_e = density.data();
+            const double *nu_ei = collFreq.data();
+            double *values = result.data();
+            parallelForRanges(result.size(), threadsCount, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (auto i = begin; i < end; ++i) {
+                    const double term = plasmaFactor * n_e[i] / (omega2 + nu_ei[i] * nu_ei[i]);
+                    const double re = 1 - term;
+                    const double im = nu_ei[i] / omega * term;
+                    const double norm = std::sqrt(re * re + im * im);
+                    values[i] = part(re, im, norm);
+                }
+            });
+            return result;
+        }
+    }
+
+    std::vector<double> calcRefractIndices(
+            ArrayView<double> density,
+            const Length &wavelength,
+            ArrayView<double> collFreq,
+            unsigned threadsCount
+    ) {
+        auto result = impl::calcPermittivityRoots(
+                density, wavelength, collFreq, threadsCount,
+                [](double re, double, double norm) {
+                    return re < 0 ? 0.0 : std::sqrt(0.5 * (norm + re));
+                }
+        );
+        for (auto value : result) {
+            if (std::isnan(value)) throw std::logic_error("Nan index of refraction!");
+        }
+        return result;
+    }
+
+    std::vector<double> calcInvBremssCoeffs(
+            ArrayView<double> density,
+            const Length &wavelength,
+            ArrayView<double> collFreq,
+            unsigned threadsCount
+    ) {
+        const double factor = 4 * M_PI / wavelength.asDouble;
+        return impl::calcPermittivityRoots(
+                density, wavelength, collFreq, threadsCount,
+                [factor](double re, double im, double norm) {
+                    // Avoid the cancellation in norm - re if the real part of the root is not small
+                    const double rootIm = re > 0 ?
+                                          im / (2 * std::sqrt(0.5 * (norm + re))) :
+                                          std::copysign(std::sqrt(0.5 * (norm - re)), im);
+                    return factor * rootIm;
+                }
+        );
+    }
+}
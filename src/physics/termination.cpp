@@ -1,5 +1,45 @@
 #include "termination.h"
+#include <algorithm>
+#include <stdexcept>
 
 namespace raytracer {
     bool dontStop(const Element &) {return false;}
-}
\ No newline at end of file
+
+    namespace impl {
+        /** Uniform number in [0, 1) given by the two keys (splitmix64 finalizer) */
+        double hashToUnit(std::uint64_t seed, std::uint64_t key) {
+            std::uint64_t z = seed + (key + 1) * 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            z = z ^ (z >> 31);
+            return static_cast<double>(z >> 11) * (1.0 / 9007199254740992.0);
+        }
+    }
+
+    StopAtPower::StopAtPower(Power absolute, double relative) :
+            absolute(absolute.asDouble),
+            relative(relative),
+            survivalProbability(0),
+            seed(0) {}
+
+    StopAtPower::StopAtPower(Power absolute, double relative, double survivalProbability, std::uint64_t seed) :
+            absolute(absolute.asDouble),
+            relative(relative),
+            survivalProbability(survivalProbability),
+            seed(seed) {
+        if (!(survivalProbability >= 0 && survivalProbability <= 1)) {
+            throw std::logic_error("Survival probability must be in [0, 1]!");
+        }
+    }
+
+    PowerFate StopAtPower::operator()(double &currentPower, double initialPower, std::int64_t crossingId) const {
+        auto threshold = std::max(absolute, relative * initialPower);
+        if (currentPower >= threshold) return PowerFate::Keep;
+        if (survivalProbability == 0) return PowerFate::CutOff;
+        if (impl::hashToUnit(seed, static_cast<std::uint64_t>(crossingId)) < survivalProbability) {
+            currentPower /= survivalProbability;
+            return PowerFate::Survived;
+        }
+        return PowerFate::Killed;
+    }
+}
@@ -0,0 +1,91 @@
+#include "parallel.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace raytracer {
+    unsigned getHardwareThreadsCount() {
+        auto count = std::thread::hardware_concurrency();
+        return count > 0 ? count : 1;
+    }
+
+    unsigned impl::resolveThreadsCount(unsigned threadsCount, std::size_t count) {
+        if (threadsCount == 0) threadsCount = getHardwareThreadsCount();
+        if (count < threadsCount) threadsCount = static_cast<unsigned>(count);
+        return std::max(threadsCount, 1u);
+    }
+
+    std::vector<double> parallelScatterAdd(
+            const std::vector<std::int32_t> &indices,
+            const std::vector<double> &values,
+            std::size_t binsCount,
+            unsigned threadsCount
+    ) {
+        if (indices.size() != values.size()) throw std::logic_error("Each value must have its bin index!");
+        std::vector<double> result(binsCount, 0);
+        auto rangesCount = impl::resolveThreadsCount(threadsCount, std::min(indices.size(), binsCount));
+        if (rangesCount == 1) {
+            for (std::size_t i = 0; i < indices.size(); ++i) {
+                if (indices[i] >= 0) result[indices[i]] += values[i];
+            }
+            return result;
+        }
+
+        // Every thread owns a contiguous range of bins. The values are taken in blocks of bounded size,
+        // each block is partitioned by the bin ranges keeping the order of the values and every thread
+        // then adds the values of its bins, so each bin is summed in the same order as in the serial loop.
+        const std::size_t binsPerRange = (binsCount + rangesCount - 1) / rangesCount;
+        const std::size_t blockSize = std::min<std::size_t>(rangesCount * (1u << 16), indices.size());
+        std::vector<std::size_t> positions(rangesCount * rangesCount);
+        std::vector<std::size_t> binRangeOffsets(rangesCount + 1);
+        std::vector<std::int32_t> blockIndices(blockSize);
+        std::vector<double> blockValues(blockSize);
+        for (std::size_t blockBegin = 0; blockBegin < indices.size(); blockBegin += blockSize) {
+            auto blockEnd = std::min(blockBegin + blockSize, indices.size());
+
+            // Count the values of each part of the block in each bin range
+            std::fill(positions.begin(), positions.end(), 0);
+            parallelForRanges(
+                    blockEnd - blockBegin,
+                    rangesCount,
+                    [&](std::size_t begin, std::size_t end, unsigned part) {
+                        auto partCounts = &positions[part * rangesCount];
+                        for (auto i = blockBegin + begin; i < blockBegin + end; ++i) {
+                            if (indices[i] >= 0) ++partCounts[indices[i] / binsPerRange];
+                        }
+                    }
+            );
+            std::size_t offset = 0;
+            for (unsigned binRange = 0; binRange < rangesCount; ++binRange) {
+                binRangeOffsets[binRange] = offset;
+                for (unsigned part = 0; part < rangesCount; ++part) {
+                    auto count = positions[part * rangesCount + binRange];
+                    positions[part * rangesCount + binRange] = offset;
+                    offset += count;
+                }
+            }
+            binRangeOffsets[rangesCount] = offset;
+
+            parallelForRanges(
+                    blockEnd - blockBegin,
+                    rangesCount,
+                    [&](std::size_t begin, std::size_t end, unsigned part) {
+                        auto partPositions = &positions[part * rangesCount];
+                        for (auto i = blockBegin + begin; i < blockBegin + end; ++i) {
+                            if (indices[i] < 0) continue;
+                            auto position = partPositions[indices[i] / binsPerRange]++;
+                            blockIndices[position] = indices[i];
+                            blockValues[position] = values[i];
+                        }
+                    }
+            );
+            parallelForRanges(rangesCount, rangesCount, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (auto binRange = begin; binRange < end; ++binRange) {
+                    for (auto i = binRangeOffsets[binRange]; i < binRangeOffsets[binRange + 1]; ++i) {
+                        result[blockIndices[i]] += blockValues[i];
+                    }
+                }
+            });
+        }
+        return result;
+    }
+}
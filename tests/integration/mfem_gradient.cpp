@@ -25,4 +25,29 @@ TEST(mfem_grad, calculates_grad_at_points_not_exactly) {
             10.0,
             meshH
     );
-}
\ No newline at end of file
+}
+
+TEST(mfem_grad, solver_can_be_reused_for_repeated_solves) {
+    using namespace raytracer;
+
+    SegmentedLine side{0.0, 1.0, 50};
+    MfemMesh mesh(side, side);
+    MfemL20Space space(mesh);
+
+    MfemMeshFunction func(space, [](const Point &point) {
+        return 3 * point.x + 4 * point.y;
+    });
+
+    auto expected = raytracer::mfemGradient(mesh, func);
+
+    MfemGradientSolver solver(mesh, func.getGF()->FESpace());
+    auto first = solver.solve(func);
+    auto second = solver.solve(func);
+    ASSERT_THAT(solver.getLastIterationsCount(), testing::Le(1));
+    for (Point *point : mesh.getInnerPoints()) {
+        ASSERT_NEAR(first.at(point).x, expected.at(point).x, 1e-6);
+        ASSERT_NEAR(first.at(point).y, expected.at(point).y, 1e-6);
+        ASSERT_NEAR(second.at(point).x, first.at(point).x, 1e-6);
+        ASSERT_NEAR(second.at(point).y, first.at(point).y, 1e-6);
+    }
+}
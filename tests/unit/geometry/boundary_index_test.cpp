@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <geometry.h>
+#include "../../support/matchers.h"
+
+
+using namespace testing;
+using namespace raytracer;
+
+class BoundaryIndexTest : public Test {
+public:
+    MfemMesh mesh{SegmentedLine{0.0, 1.0, 20}, SegmentedLine{0.0, 1.0, 10}, mfem::Element::Type::TRIANGLE};
+};
+
+TEST_F(BoundaryIndexTest, finds_the_same_entry_point_as_search_over_all_boundary_faces) {
+    std::vector<Ray> rays = {
+            Ray{Point(-1, 0.33), Vector(1, 0.1)},
+            Ray{Point(2, 0.5), Vector(-1, 0)},
+            Ray{Point(0.5, -1), Vector(0, 1)},
+            Ray{Point(-1, -1), Vector(1, 1)},
+            Ray{Point(0.35, 1.5), Vector(-0.1, -1)}
+    };
+    for (const auto &ray : rays) {
+        auto expected = findClosestIntersectionPoint(ray, mesh.getBoundary());
+        PointOnFace pointOnFace{};
+        ASSERT_TRUE(mesh.getBoundaryIndex().findEntryPoint(ray, pointOnFace));
+        EXPECT_THAT(pointOnFace.face, Eq(expected->face));
+        EXPECT_THAT(pointOnFace.point, IsSamePoint(expected->point));
+    }
+}
+
+TEST_F(BoundaryIndexTest, batch_query_returns_empty_optional_for_rays_missing_the_mesh) {
+    auto entryPoints = mesh.getBoundaryIndex().findEntryPoints(
+            {Ray{Point(-1, 0.5), Vector(1, 0)}, Ray{Point(-1, 0.5), Vector(-1, 0)}},
+            2
+    );
+
+    ASSERT_THAT(entryPoints, SizeIs(2));
+    EXPECT_TRUE(entryPoints[0]);
+    EXPECT_THAT(entryPoints[0]->point, IsSamePoint(Point(0, 0.5)));
+    EXPECT_FALSE(entryPoints[1]);
+}
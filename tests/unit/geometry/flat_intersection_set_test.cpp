@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <geometry.h>
+#include <physics.h>
+#include "../../support/matchers.h"
+
+using namespace testing;
+using namespace raytracer;
+
+class FlatIntersectionSetTest : public Test {
+public:
+    MfemMesh mesh{SegmentedLine{0.0, 10.0, 5}, SegmentedLine{0.0, 10.0, 5}, mfem::Element::Type::TRIANGLE};
+    std::vector<Ray> rays{Ray{Point(-1, 4.5), Vector(1, 0)}, Ray{Point(-1, 9), Vector(1, -1)}};
+};
+
+TEST_F(FlatIntersectionSetTest, stores_rays_one_after_another) {
+    auto intersectionSet = findFlatIntersections(mesh, rays, {ContinueStraight{}}, intersectStraight, dontStop);
+
+    ASSERT_THAT(intersectionSet.getRaysCount(), Eq(2u));
+    EXPECT_THAT(intersectionSet.getRayBegin(1), Eq(11u));
+    ASSERT_THAT(intersectionSet.getIntersectionsCount(), Eq(30u));
+}
+
+TEST_F(FlatIntersectionSetTest, gives_the_same_intersections_as_intersection_set) {
+    auto intersectionSet = findIntersections(mesh, rays, {ContinueStraight{}}, intersectStraight, dontStop);
+    FlatIntersectionSet flatSet(mesh, intersectionSet);
+    auto converted = flatSet.toIntersectionSet();
+
+    ASSERT_THAT(converted[1], SizeIs(intersectionSet[1].size()));
+    for (size_t i = 0; i < intersectionSet[1].size(); i++) {
+        EXPECT_THAT(converted[1][i].pointOnFace.point, IsSamePoint(intersectionSet[1][i].pointOnFace.point));
+        EXPECT_THAT(converted[1][i].pointOnFace.face, Eq(intersectionSet[1][i].pointOnFace.face));
+        EXPECT_THAT(converted[1][i].previousElement, Eq(intersectionSet[1][i].previousElement));
+        EXPECT_THAT(converted[1][i].nextElement, Eq(intersectionSet[1][i].nextElement));
+        EXPECT_THAT(converted[1][i].pointOnFace.id, Eq(intersectionSet[1][i].pointOnFace.id));
+        auto intersection = flatSet.getIntersection(flatSet.getRayBegin(1) + i);
+        EXPECT_THAT(intersection.pointOnFace.id, Eq(intersectionSet[1][i].pointOnFace.id));
+    }
+}
+
+TEST_F(FlatIntersectionSetTest, appending_parts_gives_the_same_set_as_appending_rays) {
+    auto intersectionSet = findIntersections(mesh, rays, {ContinueStraight{}}, intersectStraight, dontStop);
+    FlatIntersectionSet expected(mesh, intersectionSet);
+    std::vector<FlatIntersectionSet> parts{
+            FlatIntersectionSet(mesh, IntersectionSet{intersectionSet[0]}),
+            FlatIntersectionSet(mesh, IntersectionSet{{}, intersectionSet[1]})
+    };
+
+    FlatIntersectionSet result(mesh);
+    result.append(std::move(parts), 2);
+
+    ASSERT_THAT(result.getRaysCount(), Eq(3u));
+    ASSERT_THAT(result.getIntersectionsCount(), Eq(expected.getIntersectionsCount()));
+    EXPECT_THAT(result.getRayEnd(0), Eq(expected.getRayEnd(0)));
+    EXPECT_THAT(result.getRayEnd(1), Eq(expected.getRayEnd(0)));
+    for (size_t i = 0; i < result.getIntersectionsCount(); i++) {
+        EXPECT_THAT(result.getX(i), DoubleEq(expected.getX(i)));
+        EXPECT_THAT(result.getFaceId(i), Eq(expected.getFaceId(i)));
+        EXPECT_THAT(result.getPreviousElementId(i), Eq(expected.getPreviousElementId(i)));
+        EXPECT_THAT(result.getIntersection(i).pointOnFace.id, Eq(expected.getIntersection(i).pointOnFace.id));
+    }
+}
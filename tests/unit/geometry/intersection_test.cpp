@@ -19,7 +19,7 @@ TEST_F(IntersectionTest, findClosestIntersection_returns_closest_intersection_if
     Ray ray{Point(0.5, -1), Vector(0, 1)};
     Point c{0, 1}, d{1, 1};
     Face anotherFace{0, {&c, &d}};
-    auto pointOnFace = findClosestIntersectionPoint(ray, {&face, &anotherFace});
+    auto pointOnFace = findClosestIntersectionPoint(ray, std::vector<Face *>{&face, &anotherFace});
     ASSERT_THAT(pointOnFace->point, IsSamePoint(Point{0.5, 0}));
 }
 
@@ -63,4 +63,97 @@ TEST_F(IntersectionTest, intersecting_can_be_done_using_multiple_functions) {
             dontStop
     );
     ASSERT_THAT(intersections[0], SizeIs(19));
-}
\ No newline at end of file
+}
+
+TEST_F(IntersectionTest, parallel_tracing_gives_the_same_result_as_serial) {
+    std::vector<Ray> rays;
+    for (int i = 0; i < 50; i++) {
+        rays.emplace_back(Ray{Point(-1, 0.1 + 0.19 * i), Vector(1, 0.3 - 0.01 * i)});
+    }
+    auto serial = findIntersections(mesh, rays, {ContinueStraight{}}, intersectStraight, dontStop);
+    auto parallel = findIntersections(mesh, rays, {ContinueStraight{}}, intersectStraight, dontStop, nullptr, 4);
+
+    ASSERT_THAT(parallel, SizeIs(serial.size()));
+    for (size_t i = 0; i < serial.size(); i++) {
+        ASSERT_THAT(parallel[i], SizeIs(serial[i].size()));
+        for (size_t j = 0; j < serial[i].size(); j++) {
+            EXPECT_THAT(parallel[i][j].pointOnFace.point.x, Eq(serial[i][j].pointOnFace.point.x));
+            EXPECT_THAT(parallel[i][j].pointOnFace.point.y, Eq(serial[i][j].pointOnFace.point.y));
+            EXPECT_THAT(parallel[i][j].nextElement, Eq(serial[i][j].nextElement));
+            EXPECT_THAT(parallel[i][j].pointOnFace.id, Eq(serial[i][j].pointOnFace.id));
+            EXPECT_THAT(parallel[i][j].pointOnFace.id, Eq(getCrossingId(i, j)));
+        }
+    }
+}
+
+struct CountingVisitor {
+    std::vector<size_t> counts;
+    std::vector<bool> previousGiven;
+    size_t maxCount;
+
+    bool onIntersection(size_t rayIndex, const Intersection *previous, const Intersection &) {
+        counts[rayIndex]++;
+        previousGiven.emplace_back(previous != nullptr);
+        return counts[rayIndex] < maxCount;
+    }
+
+    void onRayEnd(size_t) {}
+};
+
+TEST_F(IntersectionTest, visitor_is_given_intersections_while_tracing) {
+    CountingVisitor visitor{{0}, {}, 100};
+    traceRays(mesh, {Ray{Point(-1, 4.5), Vector(1, 0)}}, {ContinueStraight{}}, intersectStraight, dontStop, visitor);
+
+    EXPECT_THAT(visitor.counts[0], Eq(11u));
+    EXPECT_FALSE(visitor.previousGiven[0]);
+    ASSERT_TRUE(visitor.previousGiven[1]);
+}
+
+TEST_F(IntersectionTest, visitor_can_stop_the_ray) {
+    CountingVisitor visitor{{0}, {}, 3};
+    traceRays(mesh, {Ray{Point(-1, 4.5), Vector(1, 0)}}, {ContinueStraight{}}, intersectStraight, dontStop, visitor);
+
+    ASSERT_THAT(visitor.counts[0], Eq(3u));
+}
+
+TEST_F(IntersectionTest, direction_functions_can_be_given_as_tuple) {
+    auto skip = [](const PointOnFace &, const Vector &) {
+        return tl::optional<Vector>{};
+    };
+    auto turn = [](const PointOnFace &, const Vector &) {
+        return tl::optional<Vector>{Vector{1, -1}};
+    };
+    Ray ray{Point(-1, 9), Vector(1, 0)};
+
+    auto fromVector = findIntersections(mesh, {ray}, {skip, turn, ContinueStraight{}}, intersectStraight, dontStop);
+    auto fromTuple = findIntersections(
+            mesh,
+            {ray},
+            std::make_tuple(skip, turn, ContinueStraight{}),
+            intersectStraight,
+            dontStop
+    );
+
+    ASSERT_THAT(fromTuple[0], SizeIs(fromVector[0].size()));
+    for (size_t i = 0; i < fromVector[0].size(); i++) {
+        EXPECT_THAT(fromTuple[0][i].pointOnFace.point, IsSamePoint(fromVector[0][i].pointOnFace.point));
+        EXPECT_THAT(fromTuple[0][i].nextElement, Eq(fromVector[0][i].nextElement));
+    }
+}
+
+TEST_F(IntersectionTest, findExitPoint_skips_given_face_and_falls_back_to_origin) {
+    Point c{0, 1}, d{1, 1};
+    Face anotherFace{1, {&c, &d}};
+    std::vector<Face *> faces{&face, &anotherFace};
+    PointOnFace pointOnFace{};
+
+    ASSERT_TRUE(findExitPoint(Ray{Point(0.5, 0), Vector(0, 1)}, faces, nullptr, pointOnFace));
+    EXPECT_THAT(pointOnFace.face, Eq(&anotherFace));
+    ASSERT_TRUE(findExitPoint(Ray{Point(0.5, 0), Vector(0, -1)}, faces, nullptr, pointOnFace));
+    EXPECT_THAT(pointOnFace.face, Eq(&face));
+
+    IntersectionTolerance strict;
+    strict.includeOrigin = false;
+    ASSERT_FALSE(findExitPoint(Ray{Point(0.5, 0), Vector(0, -1)}, faces, nullptr, pointOnFace, strict));
+    ASSERT_FALSE(findExitPoint(Ray{Point(0.5, -1), Vector(0, 1)}, std::vector<Face *>{&face}, &face, pointOnFace));
+}
@@ -50,4 +50,15 @@ TEST_F(MfemMeshTest, has_a_way_to_retrive_ordered_adjacent_points){
     EXPECT_THAT(*adjacentPoints[1], IsSamePoint(Point{1.0, 0.5}));
     EXPECT_THAT(*adjacentPoints[2], IsSamePoint(Point{0.5, 1.0}));
     ASSERT_THAT(*adjacentPoints[3], IsSamePoint(Point{0.0, 0.5}));
-}
\ No newline at end of file
+}
+
+TEST_F(MfemMeshTest, caches_unit_normals_pointing_from_first_to_second_adjacent_element){
+    for (const auto element : mesh.getElements()) {
+        for (const auto face : element->getFaces()) {
+            const auto &normal = mesh.getFaceUnitNormal(face);
+            EXPECT_THAT(normal.getNorm(), DoubleNear(1, 1e-15));
+            EXPECT_THAT(mesh.getFaceDirAdjElement(face, normal), Eq(mesh.getFaceAdjElements(face).second));
+            EXPECT_THAT(mesh.getFaceDirAdjElement(face, -1 * normal), Eq(mesh.getFaceAdjElements(face).first));
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <geometry.h>
+
+using namespace testing;
+using namespace raytracer;
+
+TEST(NodalFieldTest, only_set_values_are_valid) {
+    Point a{0, 0, 0}, b{1, 0, 1}, c{2, 0, 2};
+    NodalField<double> field(2);
+    field[&b] = 3;
+
+    EXPECT_THAT(field.find(&a), IsNull());
+    EXPECT_THAT(field.count(&b), Eq(1u));
+    EXPECT_THAT(field.at(&b), DoubleEq(3));
+    EXPECT_THAT(field.find(&c), IsNull());
+    ASSERT_THROW(field.at(&a), std::out_of_range);
+}
+
+TEST(NodalFieldTest, grows_when_higher_id_is_set) {
+    Point a{0, 0, 5};
+    NodalField<double> field;
+    field[&a] = 1;
+
+    EXPECT_THAT(field.getSlotsCount(), Eq(6u));
+    ASSERT_THAT(field.getPoint(5), Eq(&a));
+}
+
+TEST(NodalFieldTest, points_with_a_taken_or_negative_id_are_rejected) {
+    Point a{0, 0, 1}, b{1, 0, 1}, c{2, 0, -1};
+    NodalField<double> field;
+    field[&a] = 1;
+
+    EXPECT_THROW(field[&b], std::logic_error);
+    EXPECT_THROW(field[&c], std::logic_error);
+    EXPECT_THAT(field.find(&b), IsNull());
+    EXPECT_THAT(field.find(&c), IsNull());
+    EXPECT_THAT(field.getSlotsCount(), Eq(2u));
+    ASSERT_THAT(field.at(&a), DoubleEq(1));
+}
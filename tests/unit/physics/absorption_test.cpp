@@ -49,7 +49,8 @@ public:
 };
 
 TEST_F(AbsorptionTest, addModelPowers_adds_power_to_correct_elements) {
-    ModelPowersSets modelPowers = {{&mockModel, {{{0}, {3.2}}}}};
+    ModelPowersSets modelPowers({&mockModel}, {0, 2});
+    modelPowers.getPowers(0)[1] = 3.2;
 
     auto rayPowers = modelPowersToRayPowers(modelPowers, {{20}});
     absorbRayPowers(mockAbsorbedPower, rayPowers, intersections);
@@ -80,15 +81,276 @@ TEST_F(AbsorptionTest, controller_generates_absorbed_powers_for_models) {
     controller.addModel(&mockModel);
     auto modelPowers = controller.genPowers(intersections, {{20}});
 
-    ASSERT_THAT(modelPowers[&mockModel], SizeIs(1));
-    ASSERT_THAT(modelPowers[&mockModel][0], SizeIs(2));
-    EXPECT_THAT(modelPowers[&mockModel][0][0].asDouble, DoubleEq(11.2));
-    EXPECT_THAT(modelPowers[&mockModel][0][1].asDouble, DoubleEq(11.2));
+    ASSERT_THAT(modelPowers.getModelsCount(), Eq(2u));
+    ASSERT_THAT(modelPowers.getModel(0), Eq(&anotherModel));
+    ASSERT_THAT(modelPowers.getModel(1), Eq(&mockModel));
+    ASSERT_THAT(modelPowers.getRaysCount(), Eq(1u));
+    ASSERT_THAT(modelPowers.getRayEnd(0) - modelPowers.getRayBegin(0), Eq(2u));
+    EXPECT_THAT(modelPowers.getPower(1, 0, 0).asDouble, DoubleEq(11.2));
+    EXPECT_THAT(modelPowers.getPower(1, 0, 1).asDouble, DoubleEq(11.2));
+    EXPECT_THAT(modelPowers.getPower(0, 0, 0).asDouble, DoubleEq(11.2));
+    EXPECT_THAT(modelPowers.getPower(0, 0, 1).asDouble, DoubleEq(11.2));
+    EXPECT_THAT(modelPowers.getPowersSet(1), ElementsAre(SizeIs(2)));
+}
+
+TEST_F(AbsorptionTest, absorbRayPowers_skips_rays_without_intersections) {
+    PowersSet rayPowers{{Power{20}, Power{12}}, {}, {Power{20}, Power{15}}};
+    IntersectionSet withEmptyRay{intersections[0], {}, intersections[0]};
+
+    auto result = absorbRayPowers(mesh.getElements().size(), rayPowers, withEmptyRay);
+    auto flatResult = absorbRayPowers(mesh.getElements().size(), rayPowers, FlatIntersectionSet(mesh, withEmptyRay));
+
+    EXPECT_THAT(result, ElementsAre(DoubleEq(13)));
+    EXPECT_THAT(flatResult, ElementsAre(DoubleEq(13)));
+}
+
+class ManyRaysTest : public Test {
+
+public:
+    void SetUp() override {
+        controller.addModel(&bremsstrahlung);
+        controller.addModel(&zeroExchange);
+        for (int i = 0; i < 150; i++) {
+            rays.emplace_back(Ray{Point(-0.1, 0.0113 + 0.0064 * i), Vector(1, 0.4 - 0.0054 * i)});
+        }
+        initialPowers.assign(rays.size(), Power{1});
+        intersections = findIntersections(mesh, rays, {ContinueStraight()}, intersectStraight, dontStop);
+    }
+
+    static std::vector<double> genBremssCoeff(std::size_t elementsCount) {
+        std::vector<double> result;
+        for (std::size_t i = 0; i < elementsCount; i++) {
+            result.emplace_back(1 + 0.37 * (i % 7));
+        }
+        return result;
+    }
+
+    MfemMesh mesh{SegmentedLine{0.0, 1.0, 8}, SegmentedLine{0.0, 1.0, 8}};
+    std::vector<double> bremssCoeff = genBremssCoeff(mesh.getElements().size());
+    Bremsstrahlung<decltype(bremssCoeff)> bremsstrahlung{bremssCoeff};
+    ZeroExchange zeroExchange;
+    PowerExchangeController controller;
+    std::vector<Ray> rays;
+    Powers initialPowers;
+    IntersectionSet intersections;
+};
+
+TEST_F(ManyRaysTest, genPowers_and_absorbRayPowers_do_not_depend_on_threads_count) {
+    FlatIntersectionSet flatIntersections(mesh, intersections);
+    auto elementsCount = mesh.getElements().size();
+
+    auto expectedPowers = controller.genPowers(intersections, initialPowers);
+    auto powersCount = expectedPowers.getModelsCount() * expectedPowers.getIntersectionsCount();
+    std::vector<double> expected(expectedPowers.getPowers(0), expectedPowers.getPowers(0) + powersCount);
+    auto rayPowers = modelPowersToRayPowers(expectedPowers, initialPowers);
+    auto expectedAbsorbed = absorbRayPowers(elementsCount, rayPowers, intersections);
+
+    for (unsigned threadsCount : {2u, 3u, 8u}) {
+        auto powers = controller.genPowers(intersections, initialPowers, threadsCount);
+        auto flatPowers = controller.genPowers(flatIntersections, initialPowers, threadsCount);
+        EXPECT_THAT(std::vector<double>(powers.getPowers(0), powers.getPowers(0) + powersCount),
+                    ContainerEq(expected));
+        EXPECT_THAT(std::vector<double>(flatPowers.getPowers(0), flatPowers.getPowers(0) + powersCount),
+                    ContainerEq(expected));
+        EXPECT_THAT(absorbRayPowers(elementsCount, rayPowers, intersections, threadsCount),
+                    ContainerEq(expectedAbsorbed));
+        EXPECT_THAT(absorbRayPowers(elementsCount, rayPowers, flatIntersections, threadsCount),
+                    ContainerEq(expectedAbsorbed));
+    }
+}
+
+TEST_F(ManyRaysTest, traceAndExchange_matches_separate_passes_on_any_threads_count) {
+    auto modelPowers = controller.genPowers(intersections, initialPowers);
+    auto rayPowers = modelPowersToRayPowers(modelPowers, initialPowers);
+    auto expected = absorbRayPowers(mesh.getElements().size(), rayPowers, intersections);
+    double expectedBremssPower = 0;
+    for (std::size_t i = 0; i < modelPowers.getIntersectionsCount(); i++) {
+        expectedBremssPower += modelPowers.getPowers(0)[i];
+    }
+
+    auto trace = [this](unsigned threadsCount) {
+        return traceAndExchange(
+                mesh,
+                rays,
+                {ContinueStraight()},
+                intersectStraight,
+                dontStop,
+                controller,
+                initialPowers,
+                nullptr,
+                nullptr,
+                nullptr,
+                threadsCount
+        );
+    };
+    auto serial = trace(1);
+    ASSERT_THAT(serial.absorbedPowers, Pointwise(DoubleNear(1e-12), expected));
+    ASSERT_THAT(serial.finalPowers, SizeIs(rays.size()));
+    for (std::size_t i = 0; i < rays.size(); i++) {
+        EXPECT_THAT(serial.finalPowers[i].asDouble, DoubleEq(rayPowers[i].back().asDouble));
+    }
+    EXPECT_THAT(serial.modelPowers[&bremsstrahlung].asDouble, DoubleNear(expectedBremssPower, 1e-12));
+    EXPECT_THAT(serial.modelPowers[&zeroExchange].asDouble, DoubleEq(0));
+
+    for (unsigned threadsCount : {2u, 3u, 8u}) {
+        auto result = trace(threadsCount);
+        EXPECT_THAT(result.absorbedPowers, ContainerEq(serial.absorbedPowers));
+        for (std::size_t i = 0; i < rays.size(); i++) {
+            EXPECT_THAT(result.finalPowers[i].asDouble, Eq(serial.finalPowers[i].asDouble));
+        }
+        EXPECT_THAT(result.modelPowers[&bremsstrahlung].asDouble,
+                    Eq(serial.modelPowers[&bremsstrahlung].asDouble));
+    }
+}
+
+TEST_F(AbsorptionTest, traceAndExchange_matches_separate_passes) {
+    controller.addModel(&mockModel);
+    auto initialDirections = generateInitialDirections(laser);
+    Powers initialPowers(initialDirections.size(), Power{20});
+    auto modelPowers = controller.genPowers(intersections, initialPowers);
+    auto rayPowers = modelPowersToRayPowers(modelPowers, initialPowers);
+    auto expected = absorbRayPowers(mesh.getElements().size(), rayPowers, intersections);
+
+    FlatIntersectionSet trajectory(mesh);
+    auto result = traceAndExchange(
+            mesh,
+            initialDirections,
+            {ContinueStraight()},
+            intersectStraight,
+            dontStop,
+            controller,
+            initialPowers,
+            nullptr,
+            &trajectory
+    );
+
+    ASSERT_THAT(result.absorbedPowers, Pointwise(DoubleEq(), expected));
+    ASSERT_THAT(result.finalPowers, SizeIs(1));
+    EXPECT_THAT(result.finalPowers[0].asDouble, DoubleEq(rayPowers[0].back().asDouble));
+    EXPECT_THAT(result.modelPowers[&mockModel].asDouble, DoubleEq(11.2 * intersections[0].size()));
+    EXPECT_THAT(trajectory.getIntersectionsCount(), Eq(intersections[0].size()));
+}
+
+TEST_F(AbsorptionTest, static_controller_matches_runtime_controller) {
+    std::vector<double> bremssCoeff = {2.0};
+    Bremsstrahlung<decltype(bremssCoeff)> bremsstrahlung{bremssCoeff};
+    ZeroExchange zeroExchange;
+    controller.addModel(&bremsstrahlung);
+    controller.addModel(&zeroExchange);
+    auto staticController = makeStaticPowerExchangeController(bremsstrahlung, zeroExchange);
+    Powers initialPowers{Power{20}};
+
+    auto expected = controller.genPowers(intersections, initialPowers);
+    auto result = staticController.genPowers(intersections, initialPowers);
+    auto flatResult = staticController.genPowers(FlatIntersectionSet(mesh, intersections), initialPowers);
+
+    ASSERT_THAT(result.getModelsCount(), Eq(2u));
+    EXPECT_THAT(result.getModel(0), Eq(&bremsstrahlung));
+    for (std::size_t modelIndex = 0; modelIndex < 2; modelIndex++) {
+        for (std::size_t i = 0; i < intersections[0].size(); i++) {
+            auto expectedPower = expected.getPower(modelIndex, 0, i).asDouble;
+            EXPECT_THAT(result.getPower(modelIndex, 0, i).asDouble, DoubleEq(expectedPower));
+            EXPECT_THAT(flatResult.getPower(modelIndex, 0, i).asDouble, DoubleEq(expectedPower));
+        }
+    }
+}
+
+TEST(StopAtPowerTest, rays_below_threshold_are_cut_off) {
+    StopAtPower stopAtPower(Power{1}, 0.01);
+    double power = 5;
+    EXPECT_THAT(stopAtPower(power, 100, 0), Eq(PowerFate::Keep));
+    power = 0.9;
+    EXPECT_THAT(stopAtPower(power, 10, 0), Eq(PowerFate::CutOff));
+    power = 1.5;
+    EXPECT_THAT(stopAtPower(power, 200, 0), Eq(PowerFate::CutOff));
+}
+
+TEST(StopAtPowerTest, russian_roulette_keeps_expected_power) {
+    StopAtPower stopAtPower(Power{1}, 0, 0.25, 7);
+    double expectedPower = 0;
+    std::size_t survivedCount = 0;
+    const int crossingsCount = 100000;
+    for (int i = 0; i < crossingsCount; i++) {
+        double power = 0.5;
+        auto fate = stopAtPower(power, 10, getCrossingId(i, 3));
+        if (fate == PowerFate::Survived) {
+            survivedCount++;
+            expectedPower += power;
+        } else {
+            ASSERT_THAT(fate, Eq(PowerFate::Killed));
+        }
+    }
+    EXPECT_THAT(expectedPower / crossingsCount, DoubleNear(0.5, 0.01));
+    EXPECT_THAT(static_cast<double>(survivedCount) / crossingsCount, DoubleNear(0.25, 0.01));
+}
+
+class StopAtPowerTraceTest : public Test {
+
+public:
+    void SetUp() override {
+        controller.addModel(&bremsstrahlung);
+    }
+
+    ExchangeResult trace(const StopAtPower &stopAtPower) {
+        return traceAndExchange(
+                mesh,
+                rays,
+                {ContinueStraight()},
+                intersectStraight,
+                dontStop,
+                controller,
+                initialPowers,
+                &stopAtPower,
+                nullptr,
+                &errLog
+        );
+    }
+
+    // The ray crosses four elements of unit length, each of them absorbs half of the power
+    MfemMesh mesh{SegmentedLine{0.0, 4.0, 4}, SegmentedLine{0.0, 1.0, 1}};
+    std::vector<double> bremssCoeff = std::vector<double>(4, std::log(2.0));
+    Bremsstrahlung<decltype(bremssCoeff)> bremsstrahlung{bremssCoeff};
+    PowerExchangeController controller;
+    std::vector<Ray> rays{Ray{Point(-1, 0.5), Vector(1, 0)}};
+    Powers initialPowers{Power{16}};
+    InterErrLog errLog;
+};
+
+TEST_F(StopAtPowerTraceTest, cut_off_ray_deposits_its_power_downstream) {
+    auto result = trace(StopAtPower(Power{5}));
+
+    ASSERT_THAT(result.absorbedPowers, Pointwise(DoubleNear(1e-12), std::vector<double>{8, 4, 4, 0}));
+    EXPECT_THAT(result.cutOffPower.asDouble, DoubleNear(4, 1e-12));
+    EXPECT_THAT(result.finalPowers[0].asDouble, DoubleEq(0));
+    EXPECT_THAT(errLog.powerCutOff, Eq(1u));
+    EXPECT_THAT(errLog.rouletteKilled, Eq(0u));
+    EXPECT_THAT(errLog.rouletteSurvived, Eq(0u));
+}
+
+TEST_F(StopAtPowerTraceTest, ray_killed_by_roulette_loses_its_power) {
+    StopAtPower stopAtPower(Power{5}, 0, 0.5, 1);
+    double power = 4;
+    ASSERT_THAT(stopAtPower(power, 16, getCrossingId(0, 2)), Eq(PowerFate::Killed));
+
+    auto result = trace(stopAtPower);
+
+    ASSERT_THAT(result.absorbedPowers, Pointwise(DoubleNear(1e-12), std::vector<double>{8, 4, 0, 0}));
+    EXPECT_THAT(result.cutOffPower.asDouble, DoubleEq(0));
+    EXPECT_THAT(result.finalPowers[0].asDouble, DoubleEq(0));
+    EXPECT_THAT(errLog.powerCutOff, Eq(0u));
+    EXPECT_THAT(errLog.rouletteKilled, Eq(1u));
+    EXPECT_THAT(errLog.rouletteSurvived, Eq(0u));
+}
+
+TEST_F(StopAtPowerTraceTest, ray_surviving_roulette_continues) {
+    auto result = trace(StopAtPower(Power{5}, 0, 1, 1));
 
-    ASSERT_THAT(modelPowers[&anotherModel], SizeIs(1));
-    ASSERT_THAT(modelPowers[&anotherModel][0], SizeIs(2));
-    EXPECT_THAT(modelPowers[&anotherModel][0][0].asDouble, DoubleEq(11.2));
-    EXPECT_THAT(modelPowers[&anotherModel][0][1].asDouble, DoubleEq(11.2));
+    ASSERT_THAT(result.absorbedPowers, Pointwise(DoubleNear(1e-12), std::vector<double>{8, 4, 2, 1}));
+    EXPECT_THAT(result.cutOffPower.asDouble, DoubleEq(0));
+    EXPECT_THAT(result.finalPowers[0].asDouble, DoubleNear(1, 1e-12));
+    EXPECT_THAT(errLog.powerCutOff, Eq(0u));
+    EXPECT_THAT(errLog.rouletteKilled, Eq(0u));
+    EXPECT_THAT(errLog.rouletteSurvived, Eq(2u));
 }
 
 TEST(BremssTest, bremsstrahlung_power_change_is_calculated_properly) {
@@ -33,8 +33,8 @@ TEST(IntegralGradientTest, gradient_can_be_calcualted_using_integral_over_stenci
 }
 
 TEST(LinearInterpolationTest, gradinet_can_be_calculated_by_lineary_interpolating) {
-    Point a{0, 0};
-    Point b{1, 0};
+    Point a{0, 0, 0};
+    Point b{1, 0, 1};
     VectorField gradAtPoints{{&a, Vector{-1, 1}},
                              {&b, Vector{1, 1}}};
     LinInterGrad interGrad{gradAtPoints};
@@ -42,4 +42,101 @@ TEST(LinearInterpolationTest, gradinet_can_be_calculated_by_lineary_interpolatin
     PointOnFace pointOnFace{{0.5, 0}, &face, 0};
     auto result = interGrad.get(pointOnFace).value();
     ASSERT_THAT(result, IsSameVector(Vector{0, 1}));
-}
\ No newline at end of file
+}
+
+TEST(FaceInterpolationTest, gradient_interpolated_on_faces_is_the_same_as_by_nodes) {
+    MfemMesh mesh{SegmentedLine{0.0, 1.0, 3}, SegmentedLine{0.0, 1.0, 3}, mfem::Element::TRIANGLE};
+    VectorField gradAtPoints;
+    VectorField doubledGradAtPoints;
+    for (Point *point : mesh.getInnerPoints()) {
+        gradAtPoints[point] = Vector{point->x * point->x, -point->y};
+        doubledGradAtPoints[point] = 2 * gradAtPoints.at(point);
+    }
+    LinInterGrad linInterGrad{gradAtPoints};
+    FaceInterGrad faceInterGrad{mesh, gradAtPoints};
+    FaceInterGrad freshInterGrad{mesh, gradAtPoints};
+    FaceInterGrad doubledInterGrad{mesh, doubledGradAtPoints};
+    for (const Element *element : mesh.getElements()) {
+        const auto &faces = element->getFaces();
+        for (std::size_t i = 0; i < faces.size(); i++) {
+            const auto &points = faces[i]->getPoints();
+            PointOnFace pointOnFace{Point(0.3 * Vector(*points[0]) + 0.7 * Vector(*points[1])), faces[i], 0};
+            auto expected = linInterGrad.get(pointOnFace);
+            auto result = faceInterGrad.get(pointOnFace);
+            ASSERT_EQ(static_cast<bool>(result), static_cast<bool>(expected));
+            if (expected) {
+                ASSERT_THAT(result.value(), IsSameVector(expected.value()));
+            }
+
+            // The second call is answered from the memo
+            auto memoised = faceInterGrad.get(pointOnFace);
+            auto fresh = freshInterGrad.get(pointOnFace);
+            ASSERT_EQ(static_cast<bool>(memoised), static_cast<bool>(fresh));
+            if (fresh) {
+                ASSERT_THAT(memoised.value(), IsSameVector(fresh.value()));
+            }
+
+            // Another instance must not get the memoised value
+            faceInterGrad.get(pointOnFace);
+            auto doubled = doubledInterGrad.get(pointOnFace);
+            ASSERT_EQ(static_cast<bool>(doubled), static_cast<bool>(result));
+            if (result) {
+                ASSERT_THAT(doubled.value(), IsSameVector(2 * result.value()));
+            }
+
+            // Neither must another face at the same point
+            PointOnFace onOtherFace{pointOnFace.point, faces[(i + 1) % faces.size()], 0};
+            auto expectedOnOtherFace = freshInterGrad.get(onOtherFace);
+            faceInterGrad.get(pointOnFace);
+            auto resultOnOtherFace = faceInterGrad.get(onOtherFace);
+            ASSERT_EQ(static_cast<bool>(resultOnOtherFace), static_cast<bool>(expectedOnOtherFace));
+            if (expectedOnOtherFace) {
+                ASSERT_THAT(resultOnOtherFace.value(), IsSameVector(expectedOnOtherFace.value()));
+            }
+        }
+    }
+}
+
+TEST(GradientOperatorTest, assembled_operators_give_the_same_gradient_as_direct_calculation) {
+    MfemMesh mesh{SegmentedLine{0.0, 100.0, 10}, SegmentedLine{0.0, 100.0, 10}, mfem::Element::QUADRILATERAL};
+    std::vector<double> density;
+    const auto &elements = mesh.getElements();
+    std::transform(elements.begin(), elements.end(), std::back_inserter(density), [](const Element *element) {
+        auto center = getElementCentroid(*element);
+        return 12 * center.x - 7 * center.y + 0.01 * center.x * center.y;
+    });
+    auto housGrad = calcHousGrad(mesh, density);
+    auto housGradByOperator = assembleHousGradOperator(mesh).apply(density, 2);
+    auto integralGrad = calcIntegralGrad(mesh, density);
+    auto integralGradByOperator = assembleIntegralGradOperator(mesh).apply(density, 2);
+    for (Point *point : mesh.getPoints()) {
+        ASSERT_THAT(housGradByOperator.at(point), IsSameVector(housGrad.at(point)));
+        ASSERT_EQ(integralGradByOperator.count(point), integralGrad.count(point));
+    }
+    for (Point *point : mesh.getInnerPoints()) {
+        ASSERT_THAT(integralGradByOperator.at(point), IsSameVector(integralGrad.at(point)));
+    }
+}
+
+TEST(HouseGradientTest, parallel_calculation_gives_identical_result) {
+    MfemMesh mesh{SegmentedLine{0.0, 100.0, 10}, SegmentedLine{0.0, 100.0, 10}, mfem::Element::QUADRILATERAL};
+    std::vector<double> density;
+    const auto &elements = mesh.getElements();
+    std::transform(elements.begin(), elements.end(), std::back_inserter(density), [](const Element *element) {
+        auto center = getElementCentroid(*element);
+        return std::sin(0.1 * center.x) * center.y;
+    });
+    auto serialHous = calcHousGrad(mesh, density);
+    auto parallelHous = calcHousGrad(mesh, density, true, 4);
+    auto serialIntegral = calcIntegralGrad(mesh, density);
+    auto parallelIntegral = calcIntegralGrad(mesh, density, 4);
+    for (Point *point : mesh.getPoints()) {
+        ASSERT_EQ(parallelHous.at(point).x, serialHous.at(point).x);
+        ASSERT_EQ(parallelHous.at(point).y, serialHous.at(point).y);
+        ASSERT_EQ(parallelIntegral.count(point), serialIntegral.count(point));
+        if (serialIntegral.count(point)) {
+            ASSERT_EQ(parallelIntegral.at(point).x, serialIntegral.at(point).x);
+            ASSERT_EQ(parallelIntegral.at(point).y, serialIntegral.at(point).y);
+        }
+    }
+}
@@ -40,3 +40,29 @@ TEST_F(ModelsTest, inverse_bremsstrahlung_coefficient_calculation_works){
     ASSERT_THAT(calcInvBremssCoeff(density, wavelength, frequency), DoubleEq(684.32819033861733));
 }
 
+
+TEST_F(ModelsTest, batch_plasma_properties_match_scalar_versions) {
+    auto critDens = calcCritDens(wavelength).asDouble;
+    std::vector<double> densities, temperatures, ionizations;
+    for (int i = 0; i < 200; i++) {
+        densities.emplace_back(critDens * (1e-6 + 3.0 * i / 199));
+        temperatures.emplace_back(10 + 50.0 * (i % 37));
+        ionizations.emplace_back(1 + i % 13);
+    }
+
+    auto frequencies = calcSpitzerFreqs(densities, temperatures, ionizations, wavelength, 4);
+    auto refractIndices = calcRefractIndices(densities, wavelength, frequencies, 4);
+    auto bremssCoeffs = calcInvBremssCoeffs(densities, wavelength, frequencies, 4);
+    std::vector<double> noCollisions(densities.size(), 0);
+    auto collisionlessIndices = calcRefractIndices(densities, wavelength, noCollisions);
+
+    for (size_t i = 0; i < densities.size(); i++) {
+        auto frequency = calcSpitzerFreq(densities[i], temperatures[i], ionizations[i], wavelength);
+        auto refractIndex = calcRefractIndex(densities[i], wavelength, frequency);
+        auto bremssCoeff = calcInvBremssCoeff(densities[i], wavelength, frequency);
+        EXPECT_THAT(frequencies[i], DoubleNear(frequency, 1e-12 * frequency));
+        EXPECT_THAT(refractIndices[i], DoubleNear(refractIndex, 1e-12));
+        EXPECT_THAT(bremssCoeffs[i], DoubleNear(bremssCoeff, 1e-10 * bremssCoeff));
+        EXPECT_THAT(collisionlessIndices[i], DoubleNear(calcRefractIndex(densities[i], wavelength, 0), 1e-12));
+    }
+}
@@ -48,8 +48,6 @@ public:
 };
 
 TEST_F(SnellsLawTest, snells_law_bends_the_ray_as_expected) {
-    auto elements = mesh.getElements();
-
     std::vector<double> refractIndex = {
             calcRefractIndex(0, wavelength, 0),
             calcRefractIndex(3.0 / 4.0 * 6.447e20, wavelength, 0)
@@ -67,7 +65,6 @@ TEST_F(SnellsLawTest, snells_law_bends_the_ray_as_expected) {
 TEST_F(SnellsLawTest, reflects_ray_as_expected) {
     std::vector<double> refractIndex = {1, 0};
     TotalReflect<decltype(refractIndex)> totalReflect(&mesh, refractIndex, &gradient);
-    auto elements = mesh.getElements();
 
     auto newDirection = totalReflect(
             pointOnFace,
@@ -93,6 +90,64 @@ TEST_F(SnellsLawTest, reflect_on_crit_reflects_while_snell_passes) {
     ASSERT_THAT(reflectDirection.value(), IsSameVector(Vector{-1, 0}));
 }
 
+TEST_F(SnellsLawTest, refraction_chain_gives_the_same_directions_as_separate_functions) {
+    std::vector<double> dens = {1, 10};
+    std::vector<double> refractIndex = {1, 0.5};
+
+    ReflectOnCritical<decltype(dens)> reflectOnCritical(&mesh, refractIndex, dens, 20, &gradient);
+    TotalReflect<decltype(dens)> totalReflect(&mesh, refractIndex, &gradient);
+    SnellsLawBend<decltype(dens)> snellsLaw(&mesh, refractIndex, &gradient);
+    auto chain = makeRefractionChain(
+            &mesh,
+            refractIndex,
+            &gradient,
+            nullptr,
+            reflectOnCritical,
+            totalReflect,
+            snellsLaw
+    );
+
+    for (const auto &direction : {Vector{1, 0.1}, Vector{1, 1}, Vector{1, 5}, Vector{-1, 2}}) {
+        auto expected = reflectOnCritical(pointOnFace, direction);
+        if (!expected) expected = totalReflect(pointOnFace, direction);
+        if (!expected) expected = snellsLaw(pointOnFace, direction);
+        auto result = chain(pointOnFace, direction);
+        ASSERT_EQ(static_cast<bool>(result), static_cast<bool>(expected));
+        if (expected) {
+            ASSERT_THAT(result.value(), IsSameVector(expected.value()));
+        }
+    }
+}
+
+TEST(MarkerTest, crossings_of_different_rays_can_be_marked_concurrently) {
+    Marker marker;
+    std::size_t raysCount = 10000;
+    parallelFor(raysCount, 4, [&marker](std::size_t rayIndex) {
+        for (std::size_t crossingIndex = rayIndex % 3; crossingIndex < 200; crossingIndex += 3) {
+            marker.mark(PointOnFace{Point{}, nullptr, getCrossingId(rayIndex, crossingIndex)});
+        }
+    });
+    PointOnFace unmarked{Point{}, nullptr, getCrossingId(9999, 198)};
+    marker.unmark(unmarked);
+    for (std::size_t rayIndex = 0; rayIndex < raysCount; rayIndex += 97) {
+        for (std::size_t crossingIndex = 0; crossingIndex < 300; ++crossingIndex) {
+            bool expected = crossingIndex < 200 && crossingIndex % 3 == rayIndex % 3;
+            ASSERT_EQ(marker.isMarked(PointOnFace{Point{}, nullptr, getCrossingId(rayIndex, crossingIndex)}), expected);
+        }
+    }
+    ASSERT_FALSE(marker.isMarked(unmarked));
+}
+
+TEST(MarkerTest, marks_rays_with_large_index) {
+    Marker marker;
+    PointOnFace far{Point{}, nullptr, getCrossingId(50000000, 7)};
+    PointOnFace near{Point{}, nullptr, getCrossingId(3, 7)};
+    marker.mark(far);
+    ASSERT_TRUE(marker.isMarked(far));
+    ASSERT_FALSE(marker.isMarked(near));
+    ASSERT_FALSE(marker.isMarked(PointOnFace{Point{}, nullptr, getCrossingId(50000001, 7)}));
+}
+
 TEST(ReflectAtAxisTest, reflects_ray_on_axis_of_symmetry) {
     auto reflectAtAxis = [](const PointOnFace &pointOnFace, const Vector &dir) {
         if (pointOnFace.point.x >= 0.0) {
@@ -137,4 +192,3 @@ TEST(ReflectAtAxisTest, relfects_even_in_last_cell) {
     );
     ASSERT_THAT((*intersections.rbegin()->rbegin()).pointOnFace.point, IsSamePoint(Point{1.0, 0.5}));
 }
-
@@ -0,0 +1,23 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <utility.h>
+
+using namespace testing;
+using namespace raytracer;
+
+TEST(ArrayViewTest, views_vector_without_copying) {
+    std::vector<int> values = {1, 2, 3};
+    ArrayView<int> view = values;
+
+    EXPECT_THAT(view.data(), Eq(values.data()));
+    EXPECT_THAT(view, ElementsAre(1, 2, 3));
+    values[1] = 5;
+    ASSERT_THAT(view[1], Eq(5));
+}
+
+TEST(ArrayViewTest, default_view_is_empty) {
+    ArrayView<int> view;
+
+    EXPECT_TRUE(view.empty());
+    ASSERT_THAT(view.begin(), Eq(view.end()));
+}
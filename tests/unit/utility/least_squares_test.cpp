@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "least_squares.h"
+#include "qr_decomposition.h"
+
+using namespace testing;
+using namespace raytracer;
+
+TEST(small_least_squares, gives_the_same_result_as_rosetta) {
+    double in[][3] = {
+            {12, -51, 4},
+            {6, 167, -68},
+            {-4, 24, -41},
+            {-1, 1, 0},
+            {2, 0, 3},
+    };
+    double b[] = {1, -2, 3, 0.5, 7};
+
+    SmallLeastSquares<8> system;
+    rosetta::Matrix A(in);
+    rosetta::Matrix bMatrix(5, 1);
+    for (int i = 0; i < 5; ++i) {
+        system.addRow(in[i][0], in[i][1], in[i][2], b[i]);
+        bMatrix(i, 0) = b[i];
+    }
+    auto x = system.solve();
+
+    rosetta::Matrix Q, R;
+    rosetta::householder(A, R, Q);
+    Q.trim_columns(3);
+    R.trim_rows(3);
+    Q.transpose();
+    rosetta::Matrix Qtb;
+    Qtb.mult(Q, bMatrix);
+    rosetta::Matrix expected(3, 1);
+    expected.forward_substitute(R, Qtb);
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_THAT(x[i], DoubleNear(expected(i, 0), 1e-12));
+    }
+}
+
+TEST(small_least_squares, fits_plane_exactly) {
+    SmallLeastSquares<4> system;
+    system.addRow(1, 0, 0, 2);
+    system.addRow(1, 1, 0, 5);
+    system.addRow(1, 0, 1, -1);
+    system.addRow(1, 1, 1, 2);
+    auto x = system.solve();
+    ASSERT_THAT(x[0], DoubleNear(2, 1e-12));
+    ASSERT_THAT(x[1], DoubleNear(3, 1e-12));
+    ASSERT_THAT(x[2], DoubleNear(-3, 1e-12));
+}
+
+TEST(small_least_squares, throws_if_there_are_too_many_rows) {
+    SmallLeastSquares<3> system;
+    for (int i = 0; i < 3; ++i) system.addRow(1, i, i * i, 0);
+    ASSERT_THROW(system.addRow(1, 1, 1, 0), std::logic_error);
+}
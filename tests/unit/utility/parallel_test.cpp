@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <stdexcept>
+#include <utility.h>
+
+using namespace testing;
+using namespace raytracer;
+
+TEST(ParallelForTest, visits_every_index_exactly_once) {
+    std::vector<int> visits(1000, 0);
+    parallelFor(visits.size(), 4, [&visits](std::size_t i) { visits[i]++; });
+    ASSERT_THAT(visits, Each(Eq(1)));
+}
+
+TEST(ParallelForTest, rethrows_exception_from_worker) {
+    auto throwing = [](std::size_t i) {
+        if (i == 517) throw std::logic_error("Failed!");
+    };
+    ASSERT_THROW(parallelFor(1000, 4, throwing), std::logic_error);
+}
+
+TEST(ParallelForRangesTest, ranges_are_contiguous_and_cover_all_indices) {
+    std::vector<unsigned> rangeOfIndex(10, 100);
+    auto rangesCount = parallelForRanges(
+            rangeOfIndex.size(),
+            3,
+            [&](std::size_t begin, std::size_t end, unsigned range) {
+                for (auto i = begin; i < end; ++i) rangeOfIndex[i] = range;
+            }
+    );
+    EXPECT_THAT(rangesCount, Eq(3u));
+    ASSERT_THAT(rangeOfIndex, ElementsAre(0, 0, 0, 1, 1, 1, 2, 2, 2, 2));
+}
+
+TEST(ParallelScatterAddTest, result_is_the_same_as_serial_for_any_threads_count) {
+    std::vector<std::int32_t> indices;
+    std::vector<double> values;
+    // More values than fit in a block of two threads
+    for (int i = 0; i < 300000; i++) {
+        indices.emplace_back(i % 7 == 0 ? -1 : (i * 37) % 101);
+        values.emplace_back(1.0 / (i + 1) + 1e3 * (i % 3));
+    }
+    std::vector<double> expected(101, 0);
+    for (std::size_t i = 0; i < indices.size(); i++) {
+        if (indices[i] >= 0) expected[indices[i]] += values[i];
+    }
+
+    for (unsigned threadsCount : {1u, 2u, 3u, 8u}) {
+        auto result = parallelScatterAdd(indices, values, expected.size(), threadsCount);
+        ASSERT_THAT(result, ContainerEq(expected));
+    }
+}
+
+TEST(ParallelScatterAddTest, works_with_more_threads_than_bins) {
+    auto result = parallelScatterAdd({0, 1, -1, 1, 0}, {1.0, 2.0, 4.0, 8.0, 16.0}, 2, 8);
+    ASSERT_THAT(result, ElementsAre(17.0, 10.0));
+}